@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <IceUtil/Time.h>
+#include <byte_swap.h>
+#include <opencv2/core/core.hpp>
+
+
+namespace
+{
+    /// Previous conversion: reverse the whole buffer, then flip the pixel
+    /// order back and copy the result into its own cv::Mat.
+    void two_pass(
+        const std::vector<unsigned char> &bytes, unsigned char *image_cast,
+        const int &size_x, const int &size_y, const int &cv_type,
+        cv::Mat &destination)
+    {
+        std::reverse_copy(bytes.begin(), bytes.end(), image_cast);
+        cv::Mat buffer = cv::Mat(size_y, size_x, cv_type, image_cast);
+        cv::flip(buffer, buffer, -1);
+        destination = buffer.clone();
+    }
+
+    /// Seconds per call of the previous or the fused conversion.
+    double time_conversion(
+        const bool &fused, const int &size_x, const int &size_y,
+        const int &cv_type, const int &bpp, const int &repeats)
+    {
+        std::vector<unsigned char> bytes(size_x * size_y * bpp);
+        for (size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = static_cast<unsigned char>(rand());
+        }
+        unsigned char *image_cast = (unsigned char *) malloc (bytes.size());
+        cv::Mat destination(size_y, size_x, cv_type);
+        IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        for (int r = 0; r < repeats; r++) {
+            if (fused) {
+                simple_omero::byte_swap(
+                    &bytes[0], destination.data, size_x * size_y, bpp
+                );
+            } else {
+                two_pass(
+                    bytes, image_cast, size_x, size_y, cv_type, destination
+                );
+            }
+        }
+        double seconds =
+            (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+                .toSecondsDouble();
+        free(image_cast);
+        return seconds / repeats;
+    }
+}
+
+
+/// Compares the reverse_copy + cv::flip endian conversion with the single
+/// pass byte_swap kernel for each pixel width.
+///
+/// Usage: byte_swap_benchmark [size_x size_y repeats]
+int main(int argc, char *argv[])
+{
+    int size_x = 2048;
+    int size_y = 2048;
+    int repeats = 50;
+    if (argc == 4) {
+        size_x = atoi(argv[1]);
+        size_y = atoi(argv[2]);
+        repeats = atoi(argv[3]);
+    }
+    else if (argc != 1) {
+        std::cout << "Usage: " << argv[0] << " [size_x size_y repeats]\n";
+        return -1;
+    }
+    int cv_types[] = {CV_16U, CV_32F, CV_64F};
+    int widths[] = {2, 4, 8};
+    std::cout << "Plane " << size_x << "x" << size_y << "\n";
+    std::cout << "bpp\ttwo pass MB/sec\tbyte_swap MB/sec\n";
+    for (int i = 0; i < 3; i++) {
+        double megabytes = size_x * (size_y * (widths[i] / 1048576.0));
+        double two_pass_seconds = time_conversion(
+            false, size_x, size_y, cv_types[i], widths[i], repeats
+        );
+        double fused_seconds = time_conversion(
+            true, size_x, size_y, cv_types[i], widths[i], repeats
+        );
+        std::cout << widths[i] << "\t"
+                  << megabytes / two_pass_seconds << "\t\t"
+                  << megabytes / fused_seconds << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <SimpleOMERO.h>
+#include <IceUtil/Time.h>
+
+
+/// Measures the startup cost of a worker: a full login with
+/// connector::connect against joining an existing session with
+/// connector::join. Needs a live OMERO server.
+///
+/// Usage: connect_benchmark host port user pass [workers logins]
+int main(int argc, char *argv[])
+{
+    int number_of_workers = 1000;
+    int number_of_logins = 10;
+    if (argc == 7) {
+        number_of_workers = atoi(argv[5]);
+        number_of_logins = atoi(argv[6]);
+    }
+    else if (argc != 5) {
+        std::cout << "Usage: " << argv[0]
+                  << " host port user pass [workers logins]\n";
+        return -1;
+    }
+    std::string host = argv[1];
+    std::string port = argv[2];
+    std::string user = argv[3];
+    std::string pass = argv[4];
+
+    IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    for (int i = 0; i < number_of_logins; i++) {
+        simple_omero::connector *login = new simple_omero::connector();
+        if (login->connect(host, port, user, pass) != 0) {
+            return -1;
+        }
+        delete login;
+    }
+    double login_ms =
+        (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+            .toMilliSecondsDouble() / number_of_logins;
+
+    simple_omero::connector parent;
+    if (parent.connect(host, port, user, pass) != 0) {
+        return -1;
+    }
+    std::string session_key = parent.get_session_key();
+    start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    for (int i = 0; i < number_of_workers; i++) {
+        simple_omero::connector *worker = new simple_omero::connector();
+        if (worker->join(host, port, session_key) != 0) {
+            return -1;
+        }
+        delete worker;
+    }
+    double join_ms =
+        (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+            .toMilliSecondsDouble() / number_of_workers;
+
+    std::cout << "path\tms/worker\n";
+    std::cout << "connect\t" << login_ms << "\n";
+    std::cout << "join\t" << join_ms << "\n";
+    return 0;
+}
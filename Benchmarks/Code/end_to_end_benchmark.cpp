@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mock_server.h"
+#include <OMERO2CV.h>
+
+
+namespace
+{
+    /// Pixel types measured.
+    const char *const pixel_types[] = {
+        "bit", "int8", "uint8", "int16", "uint16", "int32", "uint32",
+        "float", "double"
+    };
+    const int number_of_pixel_types = 9;
+    /// Plane widths and heights measured.
+    const int plane_sizes[] = {256, 1024, 2048};
+    const int number_of_plane_sizes = 3;
+
+    double seconds_since(const IceUtil::Time &start)
+    {
+        return (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+            .toSecondsDouble();
+    }
+
+    /// Prints the throughput of a path and the requests it made; the
+    /// byte order conversion time is measured by simple_omero::rpc_stats.
+    void print_result(
+        const std::string &path, const std::string &pixel_type,
+        const int &size, const double &planes, const long long &plane_size,
+        const double &seconds, benchmark::mock_server &server)
+    {
+        simple_omero::rpc_counters decode =
+            simple_omero::rpc_stats::get(simple_omero::rpc_decode);
+        std::cout << path << "\t" << pixel_type << "\t" << size << "\t"
+                  << planes / seconds << "\t\t"
+                  << planes * (plane_size / 1048576.0) / seconds << "\t"
+                  << server.requests() << "\t\t"
+                  << decode.total_us / 1000.0 << "\n";
+        server.reset_requests();
+        simple_omero::rpc_stats::reset();
+    }
+
+    /// Reads the image with omero2cv::image::read_image, then writes it to
+    /// a new image with write_image.
+    void read_and_write(
+        benchmark::mock_server &server,
+        const omero::api::ServiceFactoryPrx &session, const int &image_id,
+        const std::string &pixel_type, const int &size)
+    {
+        omero2cv::image *source = new omero2cv::image(session, image_id);
+        source->allocate_pixel_store();
+        int planes = source->size_z * source->number_of_channels *
+            source->number_of_timepoints;
+        long long plane_size =
+            (long long) size * size * source->pixel_type_bpp;
+        server.reset_requests();
+        simple_omero::rpc_stats::reset();
+        IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        if (source->read_image() != 0) {
+            std::cout << "read_image\t" << pixel_type << "\t" << size
+                      << "\tfailed\n";
+        }
+        else {
+            print_result(
+                "read_image", pixel_type, size, planes, plane_size,
+                seconds_since(start), server
+            );
+        }
+
+        omero2cv::image *copy = new omero2cv::image(
+            session, 1, source->pixel_type_omero, size, size,
+            source->size_z, source->number_of_channels,
+            source->number_of_timepoints, "Copy", "", 1.0, 1.0, 1.0
+        );
+        server.reset_requests();
+        simple_omero::rpc_stats::reset();
+        start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        if (copy->write_image(source->pixel_store) != 0) {
+            std::cout << "write_image\t" << pixel_type << "\t" << size
+                      << "\tfailed\n";
+        }
+        else {
+            print_result(
+                "write_image", pixel_type, size, planes, plane_size,
+                seconds_since(start), server
+            );
+        }
+        delete copy;
+        delete source;
+    }
+
+    /// Reads the first plane row by row, then every stack with a single
+    /// getHypercube, through simple_omero::image.
+    void rows_and_hyper_cubes(
+        benchmark::mock_server &server,
+        const omero::api::ServiceFactoryPrx &session, const int &image_id,
+        const std::string &pixel_type, const int &size)
+    {
+        simple_omero::image image(session, image_id);
+        image.open_pixel_store(session);
+        int bpp = image.pixel_type->getBitSize()->getValue() / 8;
+        if (bpp < 1) {
+            bpp = 1;
+        }
+        long long plane_size = (long long) size * size * bpp;
+        unsigned char *buffer =
+            (unsigned char *) malloc (plane_size * image.size_z);
+        server.reset_requests();
+        simple_omero::rpc_stats::reset();
+        IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        for (int y = 0; y < image.size_y; y++) {
+            image.get_raw_pixels_row(
+                buffer + (long long) y * size * bpp, y, 0, 0, 0, bpp
+            );
+        }
+        print_result(
+            "rows", pixel_type, size, 1, plane_size, seconds_since(start),
+            server
+        );
+
+        simple_omero::hyper_cube cube;
+        for (int d = 0; d < 5; d++) {
+            cube.offset[d] = 0;
+            cube.step[d] = 1;
+        }
+        cube.size[simple_omero::hyper_cube::x] = image.size_x;
+        cube.size[simple_omero::hyper_cube::y] = image.size_y;
+        cube.size[simple_omero::hyper_cube::z] = image.size_z;
+        cube.size[simple_omero::hyper_cube::c] = 1;
+        cube.size[simple_omero::hyper_cube::t] = 1;
+        start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        for (int t = 0; t < image.number_of_timepoints; t++) {
+            for (int c = 0; c < image.number_of_channels; c++) {
+                cube.offset[simple_omero::hyper_cube::c] = c;
+                cube.offset[simple_omero::hyper_cube::t] = t;
+                image.get_raw_pixels_hyper_cube(buffer, cube, bpp);
+            }
+        }
+        print_result(
+            "hypercube", pixel_type, size,
+            image.size_z * image.number_of_channels *
+                image.number_of_timepoints,
+            plane_size, seconds_since(start), server
+        );
+        free(buffer);
+        image.close_pixel_store();
+    }
+}
+
+
+/// Reads and writes synthetic images of every pixel type and several plane
+/// sizes through an in-process mock_server, and prints the throughput and
+/// number of requests of each path: omero2cv::image::read_image and
+/// write_image, and simple_omero::image row and hypercube reads. bit and
+/// uint32 have no OpenCV type, so only the simple_omero paths are measured
+/// for them.
+///
+/// Usage: end_to_end_benchmark [latency_ms bandwidth_mb planes channels]
+int main(int argc, char *argv[])
+{
+    int latency_ms = 1;
+    double bandwidth_mb = 0;
+    int size_z = 4;
+    int number_of_channels = 2;
+    if (argc == 5) {
+        latency_ms = atoi(argv[1]);
+        bandwidth_mb = atof(argv[2]);
+        size_z = atoi(argv[3]);
+        number_of_channels = atoi(argv[4]);
+    }
+    else if (argc != 1) {
+        std::cout << "Usage: " << argv[0]
+                  << " [latency_ms bandwidth_mb planes channels]\n";
+        return -1;
+    }
+
+    benchmark::mock_server server(latency_ms, bandwidth_mb);
+    Ice::CommunicatorPtr communicator =
+        benchmark::mock_server::create_communicator(Ice::createProperties());
+    omero::api::ServiceFactoryPrx session = server.get_session(communicator);
+
+    std::cout << latency_ms << " ms latency, ";
+    if (bandwidth_mb > 0) {
+        std::cout << bandwidth_mb << " MB/sec, ";
+    }
+    std::cout << size_z << " planes x " << number_of_channels
+              << " channels\n";
+    std::cout << "path\t\ttype\tsize\tplanes/sec\tMB/sec\trequests"
+              << "\tdecode ms\n";
+    for (int s = 0; s < number_of_plane_sizes; s++) {
+        for (int p = 0; p < number_of_pixel_types; p++) {
+            std::string pixel_type = pixel_types[p];
+            int image_id = server.add_image(
+                pixel_type, plane_sizes[s], plane_sizes[s], size_z,
+                number_of_channels, 1, "Synthetic " + pixel_type
+            );
+            try {
+                if (pixel_type != "bit" && pixel_type != "uint32") {
+                    read_and_write(
+                        server, session, image_id, pixel_type, plane_sizes[s]
+                    );
+                }
+                rows_and_hyper_cubes(
+                    server, session, image_id, pixel_type, plane_sizes[s]
+                );
+            } catch (const std::exception &e) {
+                std::cout << pixel_type << "\t" << plane_sizes[s]
+                          << "\tfailed: " << e.what() << "\n";
+            }
+        }
+    }
+    communicator->destroy();
+    return 0;
+}
@@ -0,0 +1,839 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mock_server.h"
+
+
+namespace
+{
+    /// OMERO pixel types served, with their sizes in bits.
+    const char *const type_names[] = {
+        "bit", "int8", "uint8", "int16", "uint16", "int32", "uint32",
+        "float", "double"
+    };
+    const int type_bits[] = {1, 8, 8, 16, 16, 32, 32, 32, 64};
+    const int number_of_types = 9;
+    /// Offset of Pixels Ids from Image Ids, so mixing them up fails.
+    const long long pixels_id_offset = 1000000;
+
+    /// Writes value as a big-endian pixel of pixel_type.
+    void encode(
+        const int &value, const std::string &pixel_type, const int &bpp,
+        Ice::Byte *destination)
+    {
+        unsigned long long bits = value;
+        if (pixel_type == "float") {
+            float number = value;
+            unsigned int word;
+            memcpy(&word, &number, sizeof(word));
+            bits = word;
+        }
+        else if (pixel_type == "double") {
+            double number = value;
+            memcpy(&bits, &number, sizeof(bits));
+        }
+        for (int b = 0; b < bpp; b++) {
+            destination[b] =
+                static_cast<Ice::Byte>(bits >> (8 * (bpp - b - 1)));
+        }
+    }
+
+    /// Fills bytes with times copies of plane.
+    void repeat(
+        const std::vector<Ice::Byte> &plane, const int &times,
+        std::vector<Ice::Byte> &bytes)
+    {
+        bytes.resize(plane.size() * times);
+        for (int i = 0; i < times; i++) {
+            std::copy(
+                plane.begin(), plane.end(), bytes.begin() + plane.size() * i
+            );
+        }
+    }
+
+    /// Fails a request whose arguments the mock cannot serve.
+    void check(const bool &condition, const std::string &message)
+    {
+        if (!condition) {
+            throw Ice::UnknownException(__FILE__, __LINE__, message);
+        }
+    }
+
+    /// Sends a prepared reply when the link delivers it.
+    class delayed_reply : public IceUtil::TimerTask {
+        public:
+            delayed_reply(
+                const Ice::AMD_Object_ice_invokePtr &callback,
+                const std::vector<Ice::Byte> &out_params)
+            {
+                this->callback = callback;
+                this->out_params = out_params;
+            }
+            virtual void runTimerTask()
+            {
+                this->callback->ice_response(true, this->out_params);
+            }
+        private:
+            Ice::AMD_Object_ice_invokePtr callback;
+            std::vector<Ice::Byte> out_params;
+    };
+
+    /// Unmarshals a request, lets dispatch serve it and hands the reply
+    /// to the server.
+    class mock_servant : public Ice::BlobjectAsync {
+        public:
+            mock_servant(benchmark::mock_server *server)
+            {
+                this->server = server;
+            }
+            virtual void ice_invoke_async(
+                const Ice::AMD_Object_ice_invokePtr &callback,
+                const std::vector<Ice::Byte> &in_params,
+                const Ice::Current &current)
+            {
+                Ice::CommunicatorPtr communicator =
+                    current.adapter->getCommunicator();
+                Ice::InputStreamPtr in =
+                    Ice::createInputStream(communicator, in_params);
+                Ice::OutputStreamPtr out =
+                    Ice::createOutputStream(communicator);
+                in->startEncapsulation();
+                out->startEncapsulation(current.encoding, Ice::DefaultFormat);
+                try {
+                    if (current.operation != "ice_ping" &&
+                        !this->dispatch(current, in, out)) {
+                        throw Ice::OperationNotExistException(
+                            __FILE__, __LINE__, current.id, current.facet,
+                            current.operation
+                        );
+                    }
+                } catch (const std::exception &e) {
+                    callback->ice_exception(e);
+                    return;
+                }
+                out->endEncapsulation();
+                std::vector<Ice::Byte> out_params;
+                out->finished(out_params);
+                this->server->reply(
+                    current.operation, callback, out_params, in_params.size()
+                );
+            }
+        protected:
+            /// Reads the parameters of current.operation from in and
+            /// writes its results to out. Returns false if the operation
+            /// is not served.
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out) = 0;
+            benchmark::mock_server *server;
+    };
+
+    /// IContainer.
+    class container_servant : public mock_servant {
+        public:
+            container_servant(benchmark::mock_server *server)
+                : mock_servant(server) {}
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out)
+            {
+                std::string root_type;
+                omero::sys::LongList ids;
+                omero::sys::ParametersPtr options;
+                in->read(root_type);
+                in->read(ids);
+                in->read(options);
+                in->readPendingObjects();
+                if (current.operation == "getImages") {
+                    omero::api::ImageList images;
+                    for (size_t i = 0; i < ids.size(); i++) {
+                        benchmark::mock_image *image =
+                            this->server->find_image(ids.at(i));
+                        if (image != NULL) {
+                            images.push_back(this->server->describe(image));
+                        }
+                    }
+                    out->write(images);
+                }
+                else if (current.operation == "loadContainerHierarchy") {
+                    // Every Dataset exists, empty.
+                    omero::api::IObjectList datasets;
+                    for (size_t i = 0; i < ids.size(); i++) {
+                        omero::model::DatasetIPtr dataset =
+                            new omero::model::DatasetI();
+                        dataset->setId(omero::rtypes::rlong(ids.at(i)));
+                        dataset->setName(omero::rtypes::rstring("Dataset"));
+                        datasets.push_back(dataset);
+                    }
+                    out->write(datasets);
+                }
+                else {
+                    return false;
+                }
+                out->writePendingObjects();
+                return true;
+            }
+    };
+
+    /// IPixels.
+    class pixels_servant : public mock_servant {
+        public:
+            pixels_servant(benchmark::mock_server *server)
+                : mock_servant(server) {}
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out)
+            {
+                if (current.operation == "getAllEnumerations") {
+                    std::string type;
+                    in->read(type);
+                    omero::api::IObjectList enumerations;
+                    if (type == "PixelsType") {
+                        enumerations.assign(
+                            this->server->pixel_types.begin(),
+                            this->server->pixel_types.end()
+                        );
+                    }
+                    out->write(enumerations);
+                }
+                else if (current.operation == "createImage") {
+                    Ice::Int size_x, size_y, size_z, number_of_timepoints;
+                    omero::sys::IntList channels;
+                    omero::model::PixelsTypePtr pixel_type;
+                    std::string name, description;
+                    in->read(size_x);
+                    in->read(size_y);
+                    in->read(size_z);
+                    in->read(number_of_timepoints);
+                    in->read(channels);
+                    in->read(pixel_type);
+                    in->read(name);
+                    in->read(description);
+                    in->readPendingObjects();
+                    long long id = this->server->add_image(
+                        pixel_type->getValue()->getValue(), size_x, size_y,
+                        size_z, channels.size(), number_of_timepoints, name
+                    );
+                    check(id >= 0, "Pixel type not served");
+                    out->write(omero::rtypes::rlong(id));
+                }
+                else {
+                    return false;
+                }
+                out->writePendingObjects();
+                return true;
+            }
+    };
+
+    /// IQuery. findAllByQuery ignores the query and returns the Images
+    /// of the "ids" parameter, as image::load_images asks for.
+    class query_servant : public mock_servant {
+        public:
+            query_servant(benchmark::mock_server *server)
+                : mock_servant(server) {}
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out)
+            {
+                if (current.operation != "findAllByQuery") {
+                    return false;
+                }
+                std::string query;
+                omero::sys::ParametersPtr parameters;
+                in->read(query);
+                in->read(parameters);
+                in->readPendingObjects();
+                omero::api::IObjectList images;
+                omero::RListPtr ids =
+                    omero::RListPtr::dynamicCast(parameters->map["ids"]);
+                if (ids) {
+                    omero::RTypeSeq values = ids->getValue();
+                    for (size_t i = 0; i < values.size(); i++) {
+                        benchmark::mock_image *image =
+                            this->server->find_image(
+                                omero::RLongPtr::dynamicCast(values.at(i))
+                                    ->getValue()
+                            );
+                        if (image != NULL) {
+                            images.push_back(this->server->describe(image));
+                        }
+                    }
+                }
+                out->write(images);
+                out->writePendingObjects();
+                return true;
+            }
+    };
+
+    /// IUpdate. Objects are returned as saved, without being stored.
+    class update_servant : public mock_servant {
+        public:
+            update_servant(benchmark::mock_server *server)
+                : mock_servant(server) {}
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out)
+            {
+                omero::model::IObjectPtr object;
+                in->read(object);
+                in->readPendingObjects();
+                if (current.operation == "saveAndReturnObject") {
+                    out->write(object);
+                    out->writePendingObjects();
+                    return true;
+                }
+                return current.operation == "saveObject";
+            }
+    };
+
+    /// RawPixelsStore, one per createRawPixelsStore.
+    class pixels_store_servant : public mock_servant {
+        public:
+            pixels_store_servant(benchmark::mock_server *server)
+                : mock_servant(server)
+            {
+                this->image = NULL;
+            }
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out);
+        private:
+            /// Reads z, c and t and checks they are within the image.
+            void read_plane_index(const Ice::InputStreamPtr &in);
+            /// Image of the setPixelsId call.
+            benchmark::mock_image *image;
+    };
+
+
+    void pixels_store_servant::read_plane_index(
+        const Ice::InputStreamPtr &in)
+    {
+        Ice::Int z, c, t;
+        in->read(z);
+        in->read(c);
+        in->read(t);
+        check(z >= 0 && z < this->image->size_z &&
+              c >= 0 && c < this->image->number_of_channels &&
+              t >= 0 && t < this->image->number_of_timepoints,
+              "Plane out of bounds");
+    }
+
+
+    bool pixels_store_servant::dispatch(
+        const Ice::Current &current, const Ice::InputStreamPtr &in,
+        const Ice::OutputStreamPtr &out)
+    {
+        const std::string &operation = current.operation;
+        if (operation == "setPixelsId") {
+            Ice::Long pixels_id;
+            bool bypass;
+            in->read(pixels_id);
+            in->read(bypass);
+            this->image = this->server->find_pixels(pixels_id);
+            check(this->image != NULL, "Pixels not found");
+            return true;
+        }
+        if (operation == "close") {
+            this->server->remove_servant(current.id);
+            return true;
+        }
+        check(this->image != NULL, "setPixelsId not called");
+        const std::vector<Ice::Byte> &plane =
+            this->server->get_plane(this->image);
+        long long row_size =
+            (long long) this->image->size_x * this->image->bpp;
+        long long stack_size = plane.size() * this->image->size_z;
+        int stack_planes = this->image->size_z;
+        int timepoint_planes =
+            this->image->size_z * this->image->number_of_channels;
+        std::vector<Ice::Byte> bytes;
+        if (operation == "getPlane") {
+            this->read_plane_index(in);
+            out->write(plane);
+        }
+        else if (operation == "getStack") {
+            Ice::Int c, t;
+            in->read(c);
+            in->read(t);
+            repeat(plane, stack_planes, bytes);
+            out->write(bytes);
+        }
+        else if (operation == "getTimepoint") {
+            Ice::Int t;
+            in->read(t);
+            repeat(plane, timepoint_planes, bytes);
+            out->write(bytes);
+        }
+        else if (operation == "getRow") {
+            Ice::Int y;
+            in->read(y);
+            this->read_plane_index(in);
+            check(y >= 0 && y < this->image->size_y, "Row out of bounds");
+            bytes.assign(
+                plane.begin() + y * row_size,
+                plane.begin() + (y + 1) * row_size
+            );
+            out->write(bytes);
+        }
+        else if (operation == "getTile") {
+            this->read_plane_index(in);
+            Ice::Int x, y, width, height;
+            in->read(x);
+            in->read(y);
+            in->read(width);
+            in->read(height);
+            check(x >= 0 && y >= 0 && width > 0 && height > 0 &&
+                  x + width <= this->image->size_x &&
+                  y + height <= this->image->size_y,
+                  "Tile out of bounds");
+            long long tile_row = (long long) width * this->image->bpp;
+            bytes.resize(tile_row * height);
+            for (int row = 0; row < height; row++) {
+                std::copy(
+                    plane.begin() + (y + row) * row_size +
+                        x * this->image->bpp,
+                    plane.begin() + (y + row) * row_size +
+                        x * this->image->bpp + tile_row,
+                    bytes.begin() + row * tile_row
+                );
+            }
+            out->write(bytes);
+        }
+        else if (operation == "getHypercube") {
+            Ice::IntSeq offset, size, step;
+            in->read(offset);
+            in->read(size);
+            in->read(step);
+            int limits[5] = {
+                this->image->size_x, this->image->size_y,
+                this->image->size_z, this->image->number_of_channels,
+                this->image->number_of_timepoints
+            };
+            check(offset.size() == 5 && size.size() == 5 && step.size() == 5,
+                  "Hypercube needs 5 dimensions");
+            int extent[5];
+            for (int d = 0; d < 5; d++) {
+                check(offset[d] >= 0 && size[d] > 0 && step[d] > 0 &&
+                      offset[d] + size[d] <= limits[d],
+                      "Hypercube out of bounds");
+                extent[d] = (size[d] + step[d] - 1) / step[d];
+            }
+            // One subsampled plane, repeated for every z, c and t.
+            int bpp = this->image->bpp;
+            std::vector<Ice::Byte> sampled(
+                (long long) extent[0] * extent[1] * bpp
+            );
+            for (int j = 0; j < extent[1]; j++) {
+                long long row =
+                    (offset[1] + (long long) j * step[1]) * row_size;
+                for (int i = 0; i < extent[0]; i++) {
+                    long long column =
+                        (offset[0] + (long long) i * step[0]) * bpp;
+                    std::copy(
+                        plane.begin() + row + column,
+                        plane.begin() + row + column + bpp,
+                        sampled.begin() +
+                            ((long long) j * extent[0] + i) * bpp
+                    );
+                }
+            }
+            repeat(sampled, extent[2] * extent[3] * extent[4], bytes);
+            out->write(bytes);
+        }
+        else if (operation == "setPlane" || operation == "setStack" ||
+                 operation == "setTimepoint" || operation == "setRow") {
+            in->read(bytes);
+            long long expected = plane.size();
+            if (operation == "setStack") {
+                expected = stack_size;
+            }
+            else if (operation == "setTimepoint") {
+                expected = plane.size() * timepoint_planes;
+            }
+            else if (operation == "setRow") {
+                expected = row_size;
+            }
+            check((long long) bytes.size() == expected, "Wrong buffer size");
+        }
+        else if (operation == "getPlaneSize") {
+            out->write(static_cast<Ice::Int>(plane.size()));
+        }
+        else if (operation == "getRowSize") {
+            out->write(static_cast<Ice::Int>(row_size));
+        }
+        else if (operation == "getStackSize") {
+            out->write(static_cast<Ice::Int>(stack_size));
+        }
+        else if (operation == "getTimepointSize") {
+            out->write(static_cast<Ice::Int>(plane.size() * timepoint_planes));
+        }
+        else if (operation == "getTotalSize") {
+            out->write(static_cast<Ice::Long>(
+                plane.size() * timepoint_planes *
+                this->image->number_of_timepoints
+            ));
+        }
+        else if (operation == "getByteWidth") {
+            out->write(static_cast<Ice::Int>(this->image->bpp));
+        }
+        else if (operation == "getTileSize") {
+            Ice::IntSeq tile_size;
+            tile_size.push_back(std::min(this->image->size_x, 256));
+            tile_size.push_back(std::min(this->image->size_y, 256));
+            out->write(tile_size);
+        }
+        else if (operation == "getResolutionLevels") {
+            out->write(static_cast<Ice::Int>(1));
+        }
+        else if (operation == "getResolutionLevel") {
+            out->write(static_cast<Ice::Int>(0));
+        }
+        else if (operation == "setResolutionLevel") {
+            Ice::Int level;
+            in->read(level);
+            check(level == 0, "Single resolution level");
+        }
+        else if (operation == "requiresPixelsPyramid") {
+            out->write(false);
+        }
+        else if (operation == "save") {
+            out->write(omero::model::PixelsPtr());
+            out->writePendingObjects();
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    /// ServiceFactory.
+    class session_servant : public mock_servant {
+        public:
+            session_servant(
+                benchmark::mock_server *server,
+                const Ice::ObjectPrx &container, const Ice::ObjectPrx &pixels,
+                const Ice::ObjectPrx &query, const Ice::ObjectPrx &update)
+                : mock_servant(server)
+            {
+                this->container = container;
+                this->pixels = pixels;
+                this->query = query;
+                this->update = update;
+            }
+        protected:
+            virtual bool dispatch(
+                const Ice::Current &current, const Ice::InputStreamPtr &in,
+                const Ice::OutputStreamPtr &out)
+            {
+                const std::string &operation = current.operation;
+                if (operation == "getContainerService") {
+                    out->write(this->container);
+                }
+                else if (operation == "getPixelsService") {
+                    out->write(this->pixels);
+                }
+                else if (operation == "getQueryService") {
+                    out->write(this->query);
+                }
+                else if (operation == "getUpdateService") {
+                    out->write(this->update);
+                }
+                else if (operation == "createRawPixelsStore") {
+                    out->write(this->server->add_servant(
+                        new pixels_store_servant(this->server)
+                    ));
+                }
+                else if (operation == "keepAlive") {
+                    Ice::ObjectPrx service;
+                    in->read(service);
+                    out->write(true);
+                }
+                else if (operation != "closeOnDestroy" &&
+                         operation != "detachOnDestroy") {
+                    return false;
+                }
+                return true;
+            }
+        private:
+            Ice::ObjectPrx container;
+            Ice::ObjectPrx pixels;
+            Ice::ObjectPrx query;
+            Ice::ObjectPrx update;
+    };
+}
+
+
+benchmark::mock_link::mock_link(
+    const int &latency_ms, const double &bandwidth_mb)
+{
+    this->latency = IceUtil::Time::milliSeconds(latency_ms);
+    this->bytes_per_us = bandwidth_mb * 1048576.0 / 1000000.0;
+    this->free_at = IceUtil::Time::now(IceUtil::Time::Monotonic);
+}
+
+
+IceUtil::Time benchmark::mock_link::send(const long long &bytes)
+{
+    if (this->bytes_per_us <= 0) {
+        return this->latency;
+    }
+    IceUtil::Mutex::Lock lock(this->mutex);
+    IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    if (this->free_at < now) {
+        this->free_at = now;
+    }
+    this->free_at = this->free_at + IceUtil::Time::microSeconds(
+        (long long) (bytes / this->bytes_per_us)
+    );
+    return this->free_at - now + this->latency;
+}
+
+
+benchmark::mock_server::mock_server(
+    const int &latency_ms, const double &bandwidth_mb)
+{
+    this->communicator = create_communicator(Ice::createProperties());
+    this->timer = new IceUtil::Timer();
+    this->link = new mock_link(latency_ms, bandwidth_mb);
+    this->servants = 0;
+    for (int i = 0; i < number_of_types; i++) {
+        omero::model::PixelsTypeIPtr pixel_type =
+            new omero::model::PixelsTypeI();
+        pixel_type->setId(omero::rtypes::rlong(i + 1));
+        pixel_type->setValue(omero::rtypes::rstring(type_names[i]));
+        pixel_type->setBitSize(omero::rtypes::rint(type_bits[i]));
+        this->pixel_types.push_back(pixel_type);
+    }
+    this->adapter = this->communicator->createObjectAdapterWithEndpoints(
+        "Mock", "tcp -h 127.0.0.1"
+    );
+    Ice::ObjectPrx session = this->add_servant(
+        new session_servant(
+            this,
+            this->add_servant(new container_servant(this)),
+            this->add_servant(new pixels_servant(this)),
+            this->add_servant(new query_servant(this)),
+            this->add_servant(new update_servant(this))
+        )
+    );
+    this->adapter->activate();
+    this->proxy = this->communicator->proxyToString(session);
+}
+
+
+benchmark::mock_server::~mock_server()
+{
+    this->timer->destroy();
+    this->communicator->destroy();
+    delete this->link;
+    std::map<long long, mock_image *>::iterator i;
+    for (i = this->images.begin(); i != this->images.end(); i++) {
+        delete i->second;
+    }
+}
+
+
+Ice::CommunicatorPtr benchmark::mock_server::create_communicator(
+    const Ice::PropertiesPtr &properties)
+{
+    Ice::InitializationData data;
+    data.properties = properties;
+    if (data.properties->getProperty("Ice.MessageSizeMax").empty()) {
+        data.properties->setProperty("Ice.MessageSizeMax", "1048576");
+    }
+    Ice::CommunicatorPtr communicator = Ice::initialize(data);
+    // What omero::client registers, without its router.
+    omero::registerObjectFactory(communicator, NULL);
+    omero::rtypes::registerObjectFactory(communicator);
+    return communicator;
+}
+
+
+omero::api::ServiceFactoryPrx benchmark::mock_server::get_session(
+    const Ice::CommunicatorPtr &communicator)
+{
+    return omero::api::ServiceFactoryPrx::uncheckedCast(
+        communicator->stringToProxy(this->proxy)
+    );
+}
+
+
+long long benchmark::mock_server::add_image(
+    const std::string &pixel_type, const int &size_x, const int &size_y,
+    const int &size_z, const int &number_of_channels,
+    const int &number_of_timepoints, const std::string &name)
+{
+    int bits = -1;
+    for (int i = 0; i < number_of_types; i++) {
+        if (pixel_type == type_names[i]) {
+            bits = type_bits[i];
+        }
+    }
+    if (bits < 0) {
+        return -1;
+    }
+    mock_image *image = new mock_image();
+    image->name = name;
+    image->pixel_type = pixel_type;
+    image->bpp = bits / 8 > 1 ? bits / 8 : 1;
+    image->size_x = size_x;
+    image->size_y = size_y;
+    image->size_z = size_z;
+    image->number_of_channels = number_of_channels;
+    image->number_of_timepoints = number_of_timepoints;
+    IceUtil::Mutex::Lock lock(this->mutex);
+    image->id = this->images.size() + 1;
+    image->pixels_id = image->id + pixels_id_offset;
+    this->images[image->id] = image;
+    return image->id;
+}
+
+
+long long benchmark::mock_server::requests()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    long long total = 0;
+    std::map<std::string, long long>::const_iterator i;
+    for (i = this->counts.begin(); i != this->counts.end(); i++) {
+        total += i->second;
+    }
+    return total;
+}
+
+
+long long benchmark::mock_server::requests(const std::string &operation)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::map<std::string, long long>::const_iterator count =
+        this->counts.find(operation);
+    return count == this->counts.end() ? 0 : count->second;
+}
+
+
+void benchmark::mock_server::reset_requests()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    this->counts.clear();
+}
+
+
+benchmark::mock_image *benchmark::mock_server::find_image(
+    const long long &image_id)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::map<long long, mock_image *>::iterator image =
+        this->images.find(image_id);
+    return image == this->images.end() ? NULL : image->second;
+}
+
+
+benchmark::mock_image *benchmark::mock_server::find_pixels(
+    const long long &pixels_id)
+{
+    return this->find_image(pixels_id - pixels_id_offset);
+}
+
+
+const std::vector<Ice::Byte> &benchmark::mock_server::get_plane(
+    mock_image *image)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    if (image->plane.empty()) {
+        // A ramp within the range of every pixel type.
+        image->plane.resize(image->plane_size());
+        for (int y = 0; y < image->size_y; y++) {
+            for (int x = 0; x < image->size_x; x++) {
+                encode(
+                    (x + y) % 128, image->pixel_type, image->bpp,
+                    &image->plane[((long long) y * image->size_x + x) *
+                                  image->bpp]
+                );
+            }
+        }
+    }
+    return image->plane;
+}
+
+
+omero::model::ImagePtr benchmark::mock_server::describe(
+    const mock_image *image)
+{
+    omero::model::PixelsIPtr pixels = new omero::model::PixelsI();
+    pixels->setId(omero::rtypes::rlong(image->pixels_id));
+    for (int i = 0; i < number_of_types; i++) {
+        if (image->pixel_type == type_names[i]) {
+            pixels->setPixelsType(this->pixel_types.at(i));
+        }
+    }
+    pixels->setSizeX(omero::rtypes::rint(image->size_x));
+    pixels->setSizeY(omero::rtypes::rint(image->size_y));
+    pixels->setSizeZ(omero::rtypes::rint(image->size_z));
+    pixels->setSizeC(omero::rtypes::rint(image->number_of_channels));
+    pixels->setSizeT(omero::rtypes::rint(image->number_of_timepoints));
+    pixels->setPhysicalSizeX(omero::rtypes::rdouble(1.0));
+    pixels->setPhysicalSizeY(omero::rtypes::rdouble(1.0));
+    pixels->setPhysicalSizeZ(omero::rtypes::rdouble(1.0));
+    omero::model::ImageIPtr described = new omero::model::ImageI();
+    described->setId(omero::rtypes::rlong(image->id));
+    described->setName(omero::rtypes::rstring(image->name));
+    described->setDescription(omero::rtypes::rstring("Synthetic image"));
+    described->addPixels(pixels);
+    return described;
+}
+
+
+Ice::ObjectPrx benchmark::mock_server::add_servant(
+    const Ice::ObjectPtr &servant)
+{
+    std::ostringstream name;
+    {
+        IceUtil::Mutex::Lock lock(this->mutex);
+        name << "Mock-" << this->servants++;
+    }
+    return this->adapter->add(
+        servant, this->communicator->stringToIdentity(name.str())
+    );
+}
+
+
+void benchmark::mock_server::remove_servant(const Ice::Identity &identity)
+{
+    this->adapter->remove(identity);
+}
+
+
+void benchmark::mock_server::reply(
+    const std::string &operation,
+    const Ice::AMD_Object_ice_invokePtr &callback,
+    const std::vector<Ice::Byte> &out_params, const long long &request_size)
+{
+    {
+        IceUtil::Mutex::Lock lock(this->mutex);
+        this->counts[operation]++;
+    }
+    this->timer->schedule(
+        new delayed_reply(callback, out_params),
+        this->link->send(request_size + out_params.size())
+    );
+}
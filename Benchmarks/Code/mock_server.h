@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <SimpleOMERO.h>
+#include <omero/ObjectFactoryRegistrar.h>
+#include <IceUtil/Timer.h>
+
+
+namespace benchmark
+{
+#ifndef _benchmark_mock_server_included_
+#define _benchmark_mock_server_included_
+    /// \brief Image hosted by a mock_server.
+    /// \details Every plane holds the same synthetic big-endian pattern, so
+    ///          only one plane is kept in memory.
+    struct mock_image {
+        /// Image Id.
+        long long id;
+        /// Pixels Id.
+        long long pixels_id;
+        /// Image name.
+        std::string name;
+        /// OMERO pixel type, e.g. "uint16".
+        std::string pixel_type;
+        /// Bytes per pixel.
+        int bpp;
+        /// Image Width.
+        int size_x;
+        /// Image Height.
+        int size_y;
+        /// Number of planes.
+        int size_z;
+        /// Number of channels.
+        int number_of_channels;
+        /// Number of time points.
+        int number_of_timepoints;
+        /// Pattern of every plane, big-endian. Built on first read.
+        std::vector<Ice::Byte> plane;
+        /// Bytes per plane.
+        long long plane_size() const
+        {
+            return (long long) this->size_x * this->size_y * this->bpp;
+        }
+    };
+
+    /// \brief Network link shared by the replies of a mock_server.
+    /// \details A reply arrives after the latency plus the time its bytes,
+    ///          and those of the replies queued before it, take at the
+    ///          link's bandwidth.
+    class mock_link {
+        public:
+            /// Constructor.
+            /*!
+             * \param latency_ms delay of every reply in milliseconds.
+             * \param bandwidth_mb bandwidth in MB/sec; 0 for unlimited.
+             */
+            mock_link(const int &latency_ms, const double &bandwidth_mb);
+            /// Queues a message on the link.
+            /*!
+             * \param bytes message size.
+             * \return delay from now until the message arrives.
+             */
+            IceUtil::Time send(const long long &bytes);
+        private:
+            /// Delay of every reply.
+            IceUtil::Time latency;
+            /// Bytes sent per microsecond; 0 for unlimited.
+            double bytes_per_us;
+            /// When the messages queued so far have been sent.
+            IceUtil::Time free_at;
+            /// Guards free_at.
+            IceUtil::Mutex mutex;
+    };
+
+    /// \brief In-process OMERO server for benchmarks.
+    /// \details Hosts a session answering the IContainer, IPixels, IQuery,
+    ///          IUpdate and RawPixelsStore calls SimpleOMERO and OMERO2CV
+    ///          make, over synthetic images, on the loopback interface.
+    ///          The servants are dynamic, so only these operations are
+    ///          marshalled by hand. Written pixels are checked for size and
+    ///          discarded. Every request is counted by operation and its
+    ///          reply delayed by a mock_link.
+    class mock_server {
+        public:
+            /// Constructor. Starts the server.
+            /*!
+             * \param latency_ms delay of every reply in milliseconds.
+             * \param bandwidth_mb bandwidth in MB/sec; 0 for unlimited.
+             */
+            mock_server(const int &latency_ms, const double &bandwidth_mb);
+            /// Destructor. Stops the server.
+            ~mock_server();
+            /// \brief Creates a communicator able to unmarshal OMERO
+            ///        objects, without a router or a login.
+            /*!
+             * \param properties communicator properties; Ice.MessageSizeMax
+             *        is raised to 1 GB if not set.
+             * \return communicator; destroyed by the caller.
+             */
+            static Ice::CommunicatorPtr create_communicator(
+                const Ice::PropertiesPtr &properties
+            );
+            /// \brief Creates a proxy to the session.
+            /*!
+             * \param communicator client side communicator, from
+             *        create_communicator. It must not be the server's own,
+             *        so requests go through the network stack.
+             * \return session.
+             */
+            omero::api::ServiceFactoryPrx get_session(
+                const Ice::CommunicatorPtr &communicator
+            );
+            /// \brief Adds an image.
+            /*!
+             * \param pixel_type OMERO pixel type, e.g. "uint16".
+             * \param size_x image width.
+             * \param size_y image height.
+             * \param size_z number of planes.
+             * \param number_of_channels number of channels.
+             * \param number_of_timepoints number of time points.
+             * \param name image name.
+             * \return Image Id; -1 if the pixel type is not known.
+             */
+            long long add_image(
+                const std::string &pixel_type, const int &size_x,
+                const int &size_y, const int &size_z,
+                const int &number_of_channels,
+                const int &number_of_timepoints, const std::string &name
+            );
+            /// Number of requests served since the last reset_requests.
+            long long requests();
+            /// Number of requests of an operation, e.g. "getPlane", served
+            /// since the last reset_requests.
+            long long requests(const std::string &operation);
+            /// Resets the request counts.
+            void reset_requests();
+
+            // Used by the servants.
+
+            /// Finds an image by Image Id; NULL if not found.
+            mock_image *find_image(const long long &image_id);
+            /// Finds an image by Pixels Id; NULL if not found.
+            mock_image *find_pixels(const long long &pixels_id);
+            /// Gets the plane pattern of an image, building it if needed.
+            const std::vector<Ice::Byte> &get_plane(mock_image *image);
+            /// Builds the OMERO Image describing an image.
+            omero::model::ImagePtr describe(const mock_image *image);
+            /// PixelsType enumeration, one entry per known type.
+            std::vector<omero::model::PixelsTypePtr> pixel_types;
+            /// Adds a servant to the adapter under a new identity.
+            Ice::ObjectPrx add_servant(const Ice::ObjectPtr &servant);
+            /// Removes a servant from the adapter.
+            void remove_servant(const Ice::Identity &identity);
+            /// Counts a request and sends its reply once the link delivers
+            /// it.
+            void reply(
+                const std::string &operation,
+                const Ice::AMD_Object_ice_invokePtr &callback,
+                const std::vector<Ice::Byte> &out_params,
+                const long long &request_size
+            );
+        private:
+            /// Server side communicator.
+            Ice::CommunicatorPtr communicator;
+            /// Adapter hosting the servants.
+            Ice::ObjectAdapterPtr adapter;
+            /// Timer sending the delayed replies.
+            IceUtil::TimerPtr timer;
+            /// Link the replies are delayed by.
+            mock_link *link;
+            /// Stringified proxy of the session.
+            std::string proxy;
+            /// Images by Image Id.
+            std::map<long long, mock_image *> images;
+            /// Request counts by operation.
+            std::map<std::string, long long> counts;
+            /// Number of servants added, to name them.
+            long long servants;
+            /// Guards images, counts and servants.
+            IceUtil::Mutex mutex;
+    };
+#endif //_benchmark_mock_server_included_
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mock_server.h"
+
+
+namespace
+{
+    /// Unsigned OMERO pixel type of each size in bytes; NULL if none.
+    const char *pixel_type_of(const int &bpp)
+    {
+        switch (bpp) {
+            case 1:
+                return "uint8";
+            case 2:
+                return "uint16";
+            case 4:
+                return "uint32";
+            case 8:
+                return "double";
+            default:
+                return NULL;
+        }
+    }
+}
+
+
+/// Reads planes from a mock_server RawPixelsStore with an increasing number of
+/// requests in flight and prints the throughput for each depth.
+///
+/// Usage: read_pipeline_benchmark [size_x size_y bpp planes latency_ms]
+int main(int argc, char *argv[])
+{
+    int size_x = 512;
+    int size_y = 512;
+    int bpp = 2;
+    int number_of_planes = 200;
+    int latency_ms = 5;
+    if (argc == 6) {
+        size_x = atoi(argv[1]);
+        size_y = atoi(argv[2]);
+        bpp = atoi(argv[3]);
+        number_of_planes = atoi(argv[4]);
+        latency_ms = atoi(argv[5]);
+    }
+    else if (argc != 1) {
+        std::cout << "Usage: " << argv[0]
+                  << " [size_x size_y bpp planes latency_ms]\n";
+        return -1;
+    }
+
+    const char *pixel_type = pixel_type_of(bpp);
+    if (pixel_type == NULL) {
+        std::cout << "bpp must be 1, 2, 4 or 8\n";
+        return -1;
+    }
+    benchmark::mock_server server(latency_ms, 0);
+    int image_id = server.add_image(
+        pixel_type, size_x, size_y, number_of_planes, 1, 1, "Pipeline"
+    );
+    Ice::CommunicatorPtr communicator =
+        benchmark::mock_server::create_communicator(Ice::createProperties());
+    omero::api::ServiceFactoryPrx session = server.get_session(communicator);
+    simple_omero::image image(session, image_id);
+    image.open_pixel_store(session);
+    omero::api::RawPixelsStorePrx pixel_store = image.pixel_store;
+
+    std::vector<simple_omero::plane_index> planes;
+    simple_omero::plane_index index;
+    for (int z = 0; z < number_of_planes; z++) {
+        index.plane = z;
+        index.channel = 0;
+        index.time_point = 0;
+        planes.push_back(index);
+    }
+    int plane_size = size_x * size_y * bpp;
+    unsigned char *image_cast = (unsigned char *) malloc (plane_size);
+    std::vector<Ice::Byte> bytes;
+
+    std::cout << "Plane " << size_x << "x" << size_y << "x" << bpp
+              << ", " << number_of_planes << " planes, "
+              << latency_ms << " ms latency\n";
+    std::cout << "depth\tplanes/sec\tMB/sec\n";
+    int depths[] = {1, 2, 4, 8, 16, 32};
+    for (int d = 0; d < 6; d++) {
+        IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        simple_omero::plane_prefetcher prefetcher(
+            pixel_store, planes, depths[d]
+        );
+        while (prefetcher.next(bytes, index)) {
+            simple_omero::image::copy_raw_pixels(
+                bytes, image_cast, plane_size, bpp
+            );
+        }
+        double seconds =
+            (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+                .toSecondsDouble();
+        std::cout << depths[d] << "\t"
+                  << number_of_planes / seconds << "\t\t"
+                  << number_of_planes * (plane_size / 1048576.0) / seconds
+                  << "\n";
+    }
+    free(image_cast);
+    image.close_pixel_store();
+    communicator->destroy();
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "mock_server.h"
+
+
+namespace
+{
+    const simple_omero::transport_profile profiles[] = {
+        simple_omero::default_profile,
+        simple_omero::lan_bulk_profile,
+        simple_omero::wan_compressed_profile,
+        simple_omero::interactive_profile
+    };
+    const char *const profile_names[] = {
+        "default", "lan_bulk", "wan_compressed", "interactive"
+    };
+    const int number_of_profiles = 4;
+    /// getPlane requests kept in flight, as read_image does.
+    const int depth = 8;
+
+    /// Reads every plane through a plane_prefetcher and returns the time
+    /// taken in seconds; -1 if a plane could not be read, e.g. because it
+    /// does not fit in the profile's Ice.MessageSizeMax.
+    double read_planes(
+        const omero::api::RawPixelsStorePrx &pixel_store,
+        const std::vector<simple_omero::plane_index> &planes)
+    {
+        std::vector<Ice::Byte> bytes;
+        simple_omero::plane_index index;
+        IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        try {
+            simple_omero::plane_prefetcher prefetcher(
+                pixel_store, planes, depth
+            );
+            while (prefetcher.next(bytes, index)) {
+            }
+        } catch (...) {
+            return -1;
+        }
+        return (IceUtil::Time::now(IceUtil::Time::Monotonic) - start)
+            .toSecondsDouble();
+    }
+
+    void print_result(
+        const int &profile, const int &number_of_planes,
+        const long long &plane_size, const double &seconds)
+    {
+        if (seconds < 0) {
+            std::cout << profile_names[profile] << "\tfailed\n";
+            return;
+        }
+        std::cout << profile_names[profile] << "\t"
+                  << number_of_planes / seconds << "\t\t"
+                  << number_of_planes * (plane_size / 1048576.0) / seconds
+                  << "\n";
+    }
+}
+
+
+/// Reads planes with each simple_omero::transport_profile and prints the
+/// throughput of each, to pick the profile of a site.
+///
+/// Without arguments the planes come from a mock_server on the loopback
+/// interface; with a server and image they come from the image's first
+/// planes.
+///
+/// Usage: transport_benchmark [host port user pass image_id [planes]]
+int main(int argc, char *argv[])
+{
+    int number_of_planes = 100;
+    if (argc == 7) {
+        number_of_planes = atoi(argv[6]);
+    }
+    else if (argc != 1 && argc != 6) {
+        std::cout << "Usage: " << argv[0]
+                  << " [host port user pass image_id [planes]]\n";
+        return -1;
+    }
+    std::vector<simple_omero::plane_index> planes;
+    simple_omero::plane_index index;
+    std::cout << "profile\tplanes/sec\tMB/sec\n";
+
+    if (argc == 1) {
+        int size_x = 1024;
+        int size_y = 1024;
+        int bpp = 2;
+        benchmark::mock_server server(5, 0);
+        int image_id = server.add_image(
+            "uint16", size_x, size_y, number_of_planes, 1, 1, "Transport"
+        );
+        for (int z = 0; z < number_of_planes; z++) {
+            index.plane = z;
+            index.channel = 0;
+            index.time_point = 0;
+            planes.push_back(index);
+        }
+        for (int p = 0; p < number_of_profiles; p++) {
+            Ice::PropertiesPtr properties = Ice::createProperties();
+            simple_omero::apply_transport_profile(properties, profiles[p]);
+            Ice::CommunicatorPtr communicator =
+                benchmark::mock_server::create_communicator(properties);
+            omero::api::ServiceFactoryPrx session =
+                server.get_session(communicator);
+            double seconds = -1;
+            {
+                simple_omero::image image(session, image_id);
+                image.open_pixel_store(session);
+                seconds = read_planes(image.pixel_store, planes);
+                image.close_pixel_store();
+            }
+            print_result(p, number_of_planes, size_x * size_y * bpp, seconds);
+            communicator->destroy();
+        }
+        return 0;
+    }
+
+    for (int p = 0; p < number_of_profiles; p++) {
+        simple_omero::connector Omero;
+        Omero.transport = profiles[p];
+        if (Omero.connect(argv[1], argv[2], argv[3], argv[4]) != 0) {
+            return -1;
+        }
+        simple_omero::image image(Omero.get_session(), atoi(argv[5]));
+        image.open_pixel_store(Omero.get_session());
+        planes.clear();
+        for (int t = 0; t < image.number_of_timepoints; t++) {
+            for (int c = 0; c < image.number_of_channels; c++) {
+                for (int z = 0; z < image.size_z; z++) {
+                    if ((int)planes.size() < number_of_planes) {
+                        index.plane = z;
+                        index.channel = c;
+                        index.time_point = t;
+                        planes.push_back(index);
+                    }
+                }
+            }
+        }
+        double seconds = read_planes(image.pixel_store, planes);
+        print_result(
+            p, planes.size(), image.pixel_store->getPlaneSize(), seconds
+        );
+        image.close_pixel_store();
+    }
+    return 0;
+}
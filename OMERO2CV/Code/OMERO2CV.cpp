@@ -20,7 +20,281 @@
 #include "OMERO2CV.h"
 
 
-omero2cv::type_converter::type_converter(
+namespace
+{
+    /// Decodes raw OMERO plane bytes straight into the plane at
+    /// destination, allocating it only if it was not sized beforehand.
+    void decode_plane(
+        const Ice::Byte *bytes, const size_t &size, const int &size_x,
+        const int &size_y, const int &cv_type,
+        const simple_omero::byte_swap_kernel &swap, cv::Mat *destination)
+    {
+        if (!destination->isContinuous()) {
+            destination->release();
+        }
+        destination->create(size_y, size_x, cv_type);
+        if (size < destination->total() * destination->elemSize()) {
+            throw std::length_error("Short plane");
+        }
+        simple_omero::rpc_timer timer(simple_omero::rpc_decode, size);
+        swap(
+            reinterpret_cast<const unsigned char *>(bytes),
+            destination->data, (size_t) size_x * size_y
+        );
+    }
+
+
+    /// Folds planes one at a time into a z projection.
+    class projection_accumulator {
+        public:
+            projection_accumulator() {this->count = 0;};
+            /// Adds plane to the projection.
+            void fold(const int &mode, const cv::Mat &plane)
+            {
+                if (mode == o2cv_projection_max ||
+                    mode == o2cv_projection_min) {
+                    if (this->count == 0) {
+                        plane.copyTo(this->total);
+                    } else if (mode == o2cv_projection_max) {
+                        cv::max(this->total, plane, this->total);
+                    } else {
+                        cv::min(this->total, plane, this->total);
+                    }
+                    this->count++;
+                    return;
+                }
+                if (this->count == 0) {
+                    int type = CV_MAKETYPE(CV_64F, plane.channels());
+                    this->total = cv::Mat::zeros(plane.size(), type);
+                    if (mode == o2cv_projection_stddev) {
+                        this->squares = cv::Mat::zeros(plane.size(), type);
+                    }
+                }
+                // accumulate only takes 8U, 16U, 32F and 64F planes.
+                const cv::Mat *source = &plane;
+                int depth = plane.depth();
+                if (depth != CV_8U && depth != CV_16U && depth != CV_32F &&
+                    depth != CV_64F) {
+                    plane.convertTo(this->converted, CV_64F);
+                    source = &this->converted;
+                }
+                cv::accumulate(*source, this->total);
+                if (mode == o2cv_projection_stddev) {
+                    cv::accumulateSquare(*source, this->squares);
+                }
+                this->count++;
+            }
+            /// Writes the projection of the planes folded so far.
+            void result(const int &mode, cv::Mat &projection)
+            {
+                if (mode == o2cv_projection_mean) {
+                    this->total.convertTo(
+                        projection, CV_32F, 1.0 / this->count
+                    );
+                } else if (mode == o2cv_projection_stddev) {
+                    cv::Mat mean, variance;
+                    this->total.convertTo(mean, CV_64F, 1.0 / this->count);
+                    this->squares.convertTo(
+                        variance, CV_64F, 1.0 / this->count
+                    );
+                    cv::multiply(mean, mean, mean);
+                    cv::subtract(variance, mean, variance);
+                    // Rounding can leave tiny negative variances.
+                    cv::max(variance, 0.0, variance);
+                    cv::sqrt(variance, variance);
+                    variance.convertTo(projection, CV_32F);
+                } else {
+                    projection = this->total;
+                }
+            }
+        private:
+            /// Number of planes folded.
+            int count;
+            /// Running max, min or sum.
+            cv::Mat total;
+            /// Running sum of squares, for stddev.
+            cv::Mat squares;
+            /// Plane converted to CV_64F, for types accumulate lacks.
+            cv::Mat converted;
+    };
+
+
+    /// Size of the system's huge pages, 2 MB if it cannot be read.
+    size_t huge_page_size()
+    {
+        size_t size = 2 << 20;
+        FILE *meminfo = fopen("/proc/meminfo", "r");
+        if (meminfo == NULL) {
+            return size;
+        }
+        char line[256];
+        unsigned long kilobytes;
+        while (fgets(line, sizeof(line), meminfo) != NULL) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &kilobytes) == 1) {
+                size = (size_t) kilobytes << 10;
+                break;
+            }
+        }
+        fclose(meminfo);
+        return size;
+    }
+
+
+    /// Returns data itself, or a continuous copy of it if its rows are
+    /// not contiguous (e.g. an ROI), so it can be written in one piece.
+    cv::Mat continuous(const cv::Mat &data)
+    {
+        if (data.isContinuous()) {
+            return data;
+        }
+        return data.clone();
+    }
+
+
+    /// Reads a share of the planes through its own RawPixelsStore.
+    class plane_reader : public IceUtil::Thread {
+        public:
+            plane_reader(
+                const omero::api::RawPixelsStorePrx &pixel_store,
+                const int &depth, const int &size_x, const int &size_y,
+                const int &cv_type,
+                const simple_omero::byte_swap_kernel &swap,
+                const int &size_z, const int &size_c,
+                const long long &plane_size)
+            {
+                this->pixel_store = pixel_store;
+                this->depth = depth;
+                this->size_z = size_z;
+                this->size_c = size_c;
+                this->plane_size = plane_size;
+                this->size_x = size_x;
+                this->size_y = size_y;
+                this->cv_type = cv_type;
+                this->swap = swap;
+                this->failed = false;
+            }
+            /// Adds a plane to this reader's share.
+            void add(
+                const simple_omero::plane_index &index, cv::Mat *destination)
+            {
+                this->planes.push_back(index);
+                this->destinations.push_back(destination);
+            }
+            virtual void run()
+            {
+                try {
+                    simple_omero::plane_prefetcher prefetcher(
+                        this->pixel_store, this->planes, this->depth,
+                        this->size_z, this->size_c, this->plane_size
+                    );
+                    const Ice::Byte *bytes;
+                    size_t size;
+                    simple_omero::plane_index index;
+                    size_t i = 0;
+                    for (; prefetcher.next(bytes, size, index); i++) {
+                        decode_plane(
+                            bytes, size, this->size_x, this->size_y,
+                            this->cv_type, this->swap,
+                            this->destinations.at(i)
+                        );
+                    }
+                    this->failed = i != this->planes.size();
+                } catch (...) {
+                    this->failed = true;
+                }
+            }
+            /// RawPixelsStore this reader uses.
+            omero::api::RawPixelsStorePrx pixel_store;
+            /// True if reading any of the planes failed.
+            bool failed;
+        private:
+            std::vector<simple_omero::plane_index> planes;
+            std::vector<cv::Mat *> destinations;
+            int depth;
+            int size_x;
+            int size_y;
+            int cv_type;
+            simple_omero::byte_swap_kernel swap;
+            int size_z;
+            int size_c;
+            long long plane_size;
+    };
+    typedef IceUtil::Handle<plane_reader> plane_reader_ptr;
+}
+
+
+const int omero2cv::pixel_type_registry::cv_types[o2cv_number_of_types] = {
+    -1,      // bit
+    CV_8S,   // int8
+    CV_8U,   // uint8
+    CV_16S,  // int16
+    CV_32S,  // int32
+    CV_16U,  // uint16
+    -1,      // uint32
+    CV_32F,  // float
+    CV_64F,  // double
+    -1,      // complex
+    -1       // double-complex
+};
+
+
+const int omero2cv::pixel_type_registry::bpp[o2cv_number_of_types] = {
+    1, 1, 1, 2, 4, 2, 4, 4, 8, 8, 16
+};
+
+
+const char *const
+omero2cv::pixel_type_registry::names[o2cv_number_of_types] = {
+    "bit", "int8", "uint8", "int16", "int32", "uint16", "uint32", "float",
+    "double", "complex", "double-complex"
+};
+
+
+namespace
+{
+    /// Guards the registries.
+    IceUtil::StaticMutex registry_mutex = ICE_STATIC_MUTEX_INITIALIZER;
+    /// Registry of each session, by session identity.
+    std::map<std::string, omero2cv::pixel_type_registry *> registries;
+
+    /// o2cv_* index of each OpenCV depth, CV_8U to CV_64F.
+    const int cv_indices[CV_64F + 1] = {
+        o2cv_uint8, o2cv_int8, o2cv_uint16, o2cv_int16, o2cv_int32, o2cv_flt,
+        o2cv_dbl
+    };
+
+    /// o2cv_* index of an OMERO pixel type name; -1 if not listed.
+    int index_of_name(const std::string &name)
+    {
+        for (int i = 0; i < o2cv_number_of_types; i++) {
+            if (name == omero2cv::pixel_type_registry::names[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+}
+
+
+omero2cv::pixel_type_registry *omero2cv::pixel_type_registry::get(
+    const omero::api::ServiceFactoryPrx &session)
+{
+    Ice::Identity identity = session->ice_getIdentity();
+    std::string key = identity.category + "/" + identity.name;
+    IceUtil::StaticMutex::Lock lock(registry_mutex);
+    std::map<std::string, pixel_type_registry *>::iterator registry =
+        registries.find(key);
+    if (registry != registries.end()) {
+        return registry->second;
+    }
+    // Held while fetching, so concurrent first users wait for one call.
+    pixel_type_registry *created = new pixel_type_registry(session);
+    registries[key] = created;
+    return created;
+}
+
+
+omero2cv::pixel_type_registry::pixel_type_registry(
     const omero::api::ServiceFactoryPrx &session)
 {
     omero::api::IPixelsPrx pixel_service = session->getPixelsService();
@@ -28,211 +302,108 @@ omero2cv::type_converter::type_converter(
         pixel_service->getAllEnumerations("PixelsType");
     std::vector<omero::model::PixelsTypePtr> pixels =
         omero::cast<omero::model::PixelsTypePtr>(pixel_types);
-    
-    omero::model::PixelsTypePtr pixel;
-    for (int i = 0; i < pixels.size(); i++) {
-        this->omero_pixels.push_back(pixel);
-    }
+    this->omero_pixels.resize(o2cv_number_of_types);
     std::string pixel_name;
-    for (int i = 0; i < pixels.size(); i++) {
+    for (size_t i = 0; i < pixels.size(); i++) {
         pixel_name = pixels.at(i)->getValue()->getValue();
-        if (pixel_name == "bit") {
-            this->omero_pixels.at(o2cv_bit) = pixels.at(i);
-        }
-        else if (pixel_name == "int8") {
-            this->omero_pixels.at(o2cv_int8) = pixels.at(i);
-        }
-        else if (pixel_name == "uint8") {
-            this->omero_pixels.at(o2cv_uint8) = pixels.at(i);
-        }
-        else if (pixel_name == "int16") {
-            this->omero_pixels.at(o2cv_int16) = pixels.at(i);
-        }
-        else if (pixel_name == "int32") {
-            this->omero_pixels.at(o2cv_int32) = pixels.at(i);
-        }
-        else if (pixel_name == "uint16") {
-            this->omero_pixels.at(o2cv_uint16) = pixels.at(i);
-        }
-        else if (pixel_name == "uint32") {
-            this->omero_pixels.at(o2cv_uint32) = pixels.at(i);
-        }
-        else if (pixel_name == "float") {
-            this->omero_pixels.at(o2cv_flt) = pixels.at(i);
-        }
-        else if (pixel_name == "double") {
-            this->omero_pixels.at(o2cv_dbl) = pixels.at(i);
-        }
-        else if(pixel_name == "complex") {
-            this->omero_pixels.at(o2cv_complex) = pixels.at(i);
-        }
-        else if(pixel_name == "double-complex") {
-            this->omero_pixels.at(o2cv_double_complex) = pixels.at(i);
-        }
-        else {
+        int index = index_of_name(pixel_name);
+        if (index < 0) {
             std::cout << "\n\t*" << pixel_name << "* Type not found.\n";
+            continue;
         }
+        this->omero_pixels.at(index) = pixels.at(i);
+        this->indices[pixels.at(i)->getId()->getValue()] = index;
     }
 }
 
 
-int omero2cv::type_converter::omero_2_cv(
-        omero::model::PixelsTypePtr omero_type)
+int omero2cv::pixel_type_registry::index_of(
+    const omero::model::PixelsTypePtr &omero_type)
 {
-    std::string type = omero_type->getValue()->getValue();
-    if (type == "bit") {
-        std::cout << "Type not supported !!!!!!!\n";
-        return -1;
-    }
-    else if(type == "int8") {
-        return CV_8S;
-    }
-    else if(type == "uint8") {
-        return CV_8U;
-    }
-    else if(type == "int16") {
-        return CV_16S;
-    }
-    else if (type == "uint16") {
-        return CV_16U;
-    }
-    else if (type == "int32") {
-        return CV_32S;
+    try {
+        std::map<long long, int>::const_iterator index =
+            this->indices.find(omero_type->getId()->getValue());
+        if (index != this->indices.end()) {
+            return index->second;
+        }
+    } catch (...) {
     }
-    else if (type == "uint32") {
-        std::cout << "Type not supported !!!!!!!!!!\n";
+    // Types without an ID, e.g. built locally, are matched by name.
+    return index_of_name(omero_type->getValue()->getValue());
+}
+
+
+int omero2cv::pixel_type_registry::index_of(const int &cv_type)
+{
+    if (cv_type < 0 || cv_type > CV_64F) {
         return -1;
     }
-    else if (type == "float") {
-        return CV_32F;
-    }
-    else if (type == "double") {
-        return CV_64F;
-    }
-    else if (type == "complex") {
-        std::cout << "Type not supported !!!!!!!!!!\n";
+    return cv_indices[cv_type];
+}
+
+
+omero::model::PixelsTypePtr omero2cv::pixel_type_registry::omero_type(
+    const int &index)
+{
+    return this->omero_pixels.at(index);
+}
+
+
+omero2cv::type_converter::type_converter(
+    const omero::api::ServiceFactoryPrx &session)
+{
+    this->registry = pixel_type_registry::get(session);
+}
+
+
+int omero2cv::type_converter::omero_2_cv(
+        omero::model::PixelsTypePtr omero_type)
+{
+    int index = this->registry->index_of(omero_type);
+    if (index < 0) {
+        std::cout << "Type not listed!!!!!!!!\n";
         return -1;
     }
-    else if (type == "double-complex") {
+    if (pixel_type_registry::cv_types[index] < 0) {
         std::cout << "Type not supported !!!!!!!!!!\n";
-        return -1;
-    }
-    else {
-        std::cout << "Type not listed!!!!!!!!\n";
-        return -1;
     }
+    return pixel_type_registry::cv_types[index];
 }
 
 
 int omero2cv::type_converter::cv_2_omero(
     int cv_type, omero::model::PixelsTypePtr *omero_type)
 {
-    if (cv_type == CV_8S) {
-        *omero_type = this->omero_pixels.at(o2cv_int8);
-        return 0;
-    }
-    else if (cv_type == CV_8U) {
-        *omero_type = this->omero_pixels.at(o2cv_uint8);
-        return 0;
-    }
-    else if (cv_type == CV_16S) {
-        *omero_type = this->omero_pixels.at(o2cv_int16);
-        return 0;
-    }
-    else if (cv_type == CV_16U) {
-        *omero_type = this->omero_pixels.at(o2cv_uint16);
-        return 0;
-    }
-    else if (cv_type == CV_32S) {
-        *omero_type = this->omero_pixels.at(o2cv_int32);
-        return 0;
-    }
-    else if (cv_type == CV_32F) {
-        *omero_type = this->omero_pixels.at(o2cv_flt);
-        return 0;
-    }
-    else if (cv_type == CV_64F) {
-        *omero_type = this->omero_pixels.at(o2cv_dbl);
-        return 0;
-    }
-    else {
+    int index = pixel_type_registry::index_of(cv_type);
+    if (index < 0) {
         std::cout << "\n\t*" << cv_type << "* Type not supported.\n";
         return -1;
     }
+    *omero_type = this->registry->omero_type(index);
+    return 0;
 }
 
 
 int omero2cv::type_converter::get_bpp(int cv_type)
 {
-    if (cv_type == CV_8S) {
-        return 1;
-    }
-    else if (cv_type == CV_8U) {
-        return 1;
-    }
-    else if (cv_type == CV_16S) {
-        return 2;
-    }
-    else if (cv_type == CV_16U) {
-        return 2;
-    }
-    else if (cv_type == CV_32S) {
-        return 4;
-    }
-    else if (cv_type == CV_32F) {
-        return 4;
-    }
-    else if (cv_type == CV_64F) {
-        return 8;
-    }
-    else {
+    int index = pixel_type_registry::index_of(cv_type);
+    if (index < 0) {
         std::cout << "\n\t*" << cv_type << "* Type not supported.\n";
         return(-1);
     }
+    return pixel_type_registry::bpp[index];
 }
 
 
 int omero2cv::type_converter::get_bpp(
     omero::model::PixelsTypePtr omero_type)
 {
-    std::string type = omero_type->getValue()->getValue();
-    if (type == "bit") {
-        return 1;
-    }
-    else if(type == "int8") {
-        return 1;
-    }
-    else if(type == "uint8") {
-        return 1;
-    }
-    else if(type == "int16") {
-        return 2;
-    }
-    else if (type == "uint16") {
-        return 2;
-    }
-    else if (type == "int32") {
-        return 4;
-    }
-    else if (type == "uint32") {
-        return 4;
-    }
-    else if (type == "float") {
-        return 4;
-    }
-    else if (type == "double") {
-        return 8;
-    }
-    else if (type == "complex") {
-        return 8;
-    }
-    else if (type == "double-complex") {
-        return 16;
-    }
-    else {
+    int index = this->registry->index_of(omero_type);
+    if (index < 0) {
         std::cout << "Type not listed!!!!!!!!\n";
         return -1;
     }
+    return pixel_type_registry::bpp[index];
 }
 
 
@@ -257,8 +428,140 @@ void omero2cv::plane_store::allocate_zero_mat(
 }   
 
 
+void omero2cv::plane_store::allocate_mat(
+   const int &width, const int &height, const int &depth, const int &cv_type)
+{
+    this->resize(depth);
+    for (int z = 0; z < depth; z++) {
+        this->at(z).create(height, width, cv_type);
+    }
+}
+
+
+omero2cv::pixel_arena::pixel_arena(
+    const size_t &plane_size, const int &number_of_planes,
+    const int &number_of_channels, const int &number_of_timepoints,
+    const std::string &dimension_order, const bool &huge_pages)
+{
+    this->dimension_order = dimension_order;
+    if (dimension_order != "XYZCT" && dimension_order != "XYZTC" &&
+        dimension_order != "XYCZT" && dimension_order != "XYCTZ" &&
+        dimension_order != "XYTZC" && dimension_order != "XYTCZ") {
+        std::cout << "\t*" << dimension_order
+                  << "* Dimension order not supported, using XYZCT.\n";
+        this->dimension_order = "XYZCT";
+    }
+    // The first dimension after XY varies fastest.
+    size_t stride = plane_size;
+    for (int i = 2; i < 5; i++) {
+        switch (this->dimension_order[i]) {
+            case 'Z':
+                this->stride_z = stride;
+                stride *= number_of_planes;
+                break;
+            case 'C':
+                this->stride_c = stride;
+                stride *= number_of_channels;
+                break;
+            case 'T':
+                this->stride_t = stride;
+                stride *= number_of_timepoints;
+                break;
+        }
+    }
+    this->length = stride;
+    this->mapped_length = stride;
+    this->bytes = NULL;
+    this->mapped = false;
+#ifdef MAP_ANONYMOUS
+    if (huge_pages) {
+        void *address = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        // Explicit huge pages, only available if the system reserved some.
+        // Their mappings must be whole pages, or munmap fails.
+        size_t page = huge_page_size();
+        this->mapped_length = (this->length + page - 1) / page * page;
+        address = mmap(
+            NULL, this->mapped_length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+        );
+#endif
+        if (address == MAP_FAILED) {
+            this->mapped_length = this->length;
+            address = mmap(
+                NULL, this->length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+            );
+#ifdef MADV_HUGEPAGE
+            // Fall back to transparent huge pages.
+            if (address != MAP_FAILED) {
+                madvise(address, this->length, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (address != MAP_FAILED) {
+            this->bytes = static_cast<unsigned char *>(address);
+            this->mapped = true;
+        }
+    }
+#endif
+    if (this->bytes == NULL) {
+        void *address = NULL;
+        // Cache line aligned so every plane of a 64 byte multiple size
+        // starts on a cache line.
+        if (posix_memalign(&address, 64, this->length) != 0) {
+            std::cout << "\tCould not allocate pixel arena!!!!\n";
+            throw std::bad_alloc();
+        }
+        this->bytes = static_cast<unsigned char *>(address);
+    }
+}
+
+
+omero2cv::pixel_arena::~pixel_arena()
+{
+#ifdef MAP_ANONYMOUS
+    if (this->mapped) {
+        munmap(this->bytes, this->mapped_length);
+        return;
+    }
+#endif
+    free(this->bytes);
+}
+
+
+unsigned char *omero2cv::pixel_arena::plane(
+    const int &z, const int &c, const int &t)
+{
+    return this->bytes
+        + z * this->stride_z + c * this->stride_c + t * this->stride_t;
+}
+
+
+size_t omero2cv::pixel_arena::stride(const char &dimension) const
+{
+    switch (dimension) {
+        case 'Z':
+            return this->stride_z;
+        case 'C':
+            return this->stride_c;
+        case 'T':
+            return this->stride_t;
+    }
+    return 0;
+}
+
+
 void omero2cv::image::allocate_zero_mat()
 {
+    // Assigning new Mats would detach the planes from the arena.
+    if (this->pixel_store->arena != NULL) {
+        memset(
+            this->pixel_store->arena->data(), 0,
+            this->pixel_store->arena->size()
+        );
+        return;
+    }
     cv::Mat temp_buffer =
         cv::Mat::zeros(this->size_y, this->size_x, this->pixel_type_cv);
     for (int t = 0; t < this->pixel_store_timepoints; t++) {
@@ -273,7 +576,7 @@ void omero2cv::image::allocate_zero_mat()
 
 omero2cv::image::~image()
 {
-    std::cout << "closing stuff\n";
+    simpleomero_log(simpleomero_log_debug, "Closing image " << this->id);
     this->clear_pixel_store();
     this->omero_image->close_pixel_store();
     delete this->omero_image;
@@ -285,12 +588,55 @@ omero2cv::image::image(
     const omero::api::ServiceFactoryPrx &session, const int &image_id)
 {
 /// Still Needs Error Handling!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+    this->set_up(session, new simple_omero::image(session, image_id));
+}
+
+
+omero2cv::image::image(
+    const omero::api::ServiceFactoryPrx &session,
+    simple_omero::image *handle)
+{
+    this->set_up(session, handle);
+}
+
+
+std::vector<omero2cv::image *> omero2cv::image::load_images(
+    const omero::api::ServiceFactoryPrx &session,
+    const std::vector<int> &image_ids)
+{
+    std::vector<simple_omero::image *> handles =
+        simple_omero::image::load_images(session, image_ids);
+    std::vector<image *> images;
+    try {
+        for (size_t i = 0; i < handles.size(); i++) {
+            images.push_back(new image(session, handles.at(i)));
+        }
+    } catch (...) {
+        // A constructor that throws does not take its handle, so every
+        // handle from the failing one on is still ours.
+        for (size_t i = 0; i < images.size(); i++) {
+            delete images.at(i);
+        }
+        for (size_t i = images.size(); i < handles.size(); i++) {
+            delete handles.at(i);
+        }
+        throw;
+    }
+    return images;
+}
+
+
+void omero2cv::image::set_up(
+    const omero::api::ServiceFactoryPrx &session,
+    simple_omero::image *handle)
+{
     this->timepoint_list.clear();
     this->channel_list.clear();
     this->plane_list.clear();
     
-    this->id = image_id;
-    this->omero_image = new simple_omero::image(session, image_id);
+    this->id = handle->id;
+    this->omero_image = handle;
+    this->session = session;
     this->omero_image->open_pixel_store(session);
     this->name = this->omero_image->name;
     this->description = this->omero_image->description;
@@ -312,6 +658,18 @@ omero2cv::image::image(
     this->pixel_type_omero = this->omero_image->pixel_type;
     this->pixel_type_cv = converter->omero_2_cv(this->pixel_type_omero);
     this->pixel_type_bpp = converter->get_bpp(this->pixel_type_cv);
+    this->swap_kernel =
+        simple_omero::get_byte_swap_kernel(this->pixel_type_bpp);
+    this->prefetch_depth = o2cv_default_prefetch_depth;
+    this->write_depth = o2cv_default_write_depth;
+    this->number_of_readers = o2cv_default_number_of_readers;
+    this->tile_width = 0;
+    this->tile_height = 0;
+    this->use_arena = false;
+    this->cache = NULL;
+    this->resolution_level = -1;
+    this->arena_dimension_order = "XYZCT";
+    this->arena_huge_pages = false;
 
     for (int t = 0; t < this->number_of_timepoints; t++) {
         this->timepoint_list.push_back(t);
@@ -352,6 +710,7 @@ omero2cv::image::image(
     
     this->id = image_id;
     this->omero_image = new simple_omero::image(session, image_id);
+    this->session = session;
     this->omero_image->open_pixel_store(session);
     this->name = this->omero_image->name;
     this->description = this->omero_image->description;
@@ -371,6 +730,18 @@ omero2cv::image::image(
     this->pixel_type_omero = this->omero_image->pixel_type;
     this->pixel_type_cv = converter->omero_2_cv(this->pixel_type_omero);
     this->pixel_type_bpp = converter->get_bpp(this->pixel_type_cv);
+    this->swap_kernel =
+        simple_omero::get_byte_swap_kernel(this->pixel_type_bpp);
+    this->prefetch_depth = o2cv_default_prefetch_depth;
+    this->write_depth = o2cv_default_write_depth;
+    this->number_of_readers = o2cv_default_number_of_readers;
+    this->tile_width = 0;
+    this->tile_height = 0;
+    this->use_arena = false;
+    this->cache = NULL;
+    this->resolution_level = -1;
+    this->arena_dimension_order = "XYZCT";
+    this->arena_huge_pages = false;
     
     this->pixel_store = new image_store();
     this->pixel_store_timepoints = timepoint_list.size();
@@ -401,6 +772,7 @@ omero2cv::image::image(
         pixel_size_x, pixel_size_y, pixel_size_z
     );
     
+    this->session = session;
     this->omero_image->open_pixel_store(session);
     this->name = this->omero_image->name;
     this->description = this->omero_image->description;
@@ -420,6 +792,18 @@ omero2cv::image::image(
     this->pixel_type_omero = this->omero_image->pixel_type;
     this->pixel_type_cv = converter->omero_2_cv(this->pixel_type_omero);
     this->pixel_type_bpp = converter->get_bpp(this->pixel_type_cv);
+    this->swap_kernel =
+        simple_omero::get_byte_swap_kernel(this->pixel_type_bpp);
+    this->prefetch_depth = o2cv_default_prefetch_depth;
+    this->write_depth = o2cv_default_write_depth;
+    this->number_of_readers = o2cv_default_number_of_readers;
+    this->tile_width = 0;
+    this->tile_height = 0;
+    this->use_arena = false;
+    this->cache = NULL;
+    this->resolution_level = -1;
+    this->arena_dimension_order = "XYZCT";
+    this->arena_huge_pages = false;
     
     this->pixel_store = new image_store();
     this->pixel_store_timepoints = this->number_of_timepoints;
@@ -436,7 +820,6 @@ omero2cv::image::image(
 
 int omero2cv::image::write_image(omero2cv::image_store *image)
 {
-    simple_omero::logger *log = new simple_omero::logger();
     if (this->number_of_timepoints != image->size()) {
         std::cout << "\tNumber of time points incorrect!!!!\n";
         return -1;
@@ -451,28 +834,34 @@ int omero2cv::image::write_image(omero2cv::image_store *image)
         return -1;
     }
     
-    unsigned char *buffer;
     cv::Mat image_temp;
+    simple_omero::plane_writer writer(
+        this->omero_image->source, this->omero_image->pixels_id,
+        this->write_depth, this->omero_image->size_z,
+        this->omero_image->number_of_channels
+    );
+    simple_omero::plane_index index;
     for (int t = 0; t < this->number_of_timepoints; t++) {
         for (int c = 0; c < this->number_of_channels; c++) {
-            std::cout << log->date_time_now()
-                      << " Writing Image: " << this->omero_image->id
-                      << " time point: " << t
-                      << " channel: " << c
-                      << "\n";
+            simpleomero_log(simpleomero_log_debug,
+                "Writing Image: " << this->omero_image->id
+                << " time point: " << t << " channel: " << c
+            );
             for (int z = 0; z < this->size_z; z++) {
-                image_temp =
-                    image->t(t)->c(c)->z(z).clone();
-                if (this->pixel_type_bpp > 1) {
-                    cv::flip(image_temp, image_temp, -1);
-                }
-                buffer = reinterpret_cast<unsigned char *>(image_temp.data);
-                this->omero_image->write_plane(
-                    buffer, this->pixel_type_bpp, t, c, z);
+                image_temp = continuous(image->t(t)->c(c)->z(z));
+                index.plane = z;
+                index.channel = c;
+                index.time_point = t;
+                writer.write(
+                    image_temp.data, this->size_x, this->size_y,
+                    this->pixel_type_bpp, index
+                );
             }
         }
     }
-    return 0;
+    int status = this->flush_writer(writer);
+    this->drop_cached_planes();
+    return status;
 }
 
 
@@ -480,28 +869,79 @@ int omero2cv::image::write_channel(
     omero2cv::plane_store *stack,
     const int &timepoint, const int &channel)
 {
-    simple_omero::logger *log = new simple_omero::logger();
     if (this->pixel_store->size_z != stack->size()) {
         std::cout << "\tNumber of planes incorrect!!!!!!\n";
         return -1;
     }
-    unsigned char *buffer;
     cv::Mat image_temp;
-    std::cout << log->date_time_now()
-              << " Writing Image: " << this->omero_image->id
-              << " time point: " << timepoint
-              << " channel: " << channel
-              << "\n";
+    simpleomero_log(simpleomero_log_debug,
+        "Writing Image: " << this->omero_image->id
+        << " time point: " << timepoint << " channel: " << channel
+    );
+    simple_omero::plane_writer writer(
+        this->omero_image->source, this->omero_image->pixels_id,
+        this->write_depth, this->omero_image->size_z,
+        this->omero_image->number_of_channels
+    );
+    simple_omero::plane_index index;
+    index.channel = channel;
+    index.time_point = timepoint;
     for (int z = 0; z < this->pixel_store->size_z; z++) {
-        image_temp = stack->z(z).clone();
-        if (this->pixel_type_bpp > 1) {
-            cv::flip(image_temp, image_temp, -1);
+        image_temp = continuous(stack->z(z));
+        index.plane = z;
+        writer.write(
+            image_temp.data, this->size_x, this->size_y,
+            this->pixel_type_bpp, index
+        );
+    }
+    int status = this->flush_writer(writer);
+    this->drop_cached_planes();
+    return status;
+}
+
+
+simple_omero::plane_prefetcher *omero2cv::image::create_plane_prefetcher()
+{
+    std::vector<simple_omero::plane_index> planes;
+    simple_omero::plane_index index;
+    for (size_t t = 0; t < this->timepoint_list.size(); t++) {
+        for (size_t c = 0; c < this->channel_list.size(); c++) {
+            for (size_t z = 0; z < this->plane_list.size(); z++) {
+                index.plane = this->plane_list.at(z);
+                index.channel = this->channel_list.at(c);
+                index.time_point = this->timepoint_list.at(t);
+                planes.push_back(index);
+            }
         }
-        buffer = reinterpret_cast<unsigned char *>(image_temp.data);
-        this->omero_image->write_plane(
-            buffer, this->pixel_type_bpp, timepoint, channel, z);
     }
-    return 0;
+    // Plane by plane, so only prefetch_depth planes are held.
+    return new simple_omero::plane_prefetcher(
+        this->omero_image->source, planes, this->prefetch_depth
+    );
+}
+
+
+long long omero2cv::image::block_plane_size()
+{
+    // Stacks and time points are only served at full resolution.
+    if (this->resolution_level >= 0) {
+        return 0;
+    }
+    return (long long) this->size_x * this->size_y * this->pixel_type_bpp;
+}
+
+
+int omero2cv::image::flush_writer(simple_omero::plane_writer &writer)
+{
+    std::vector<simple_omero::plane_index> failed = writer.flush();
+    for (size_t i = 0; i < failed.size(); i++) {
+        simpleomero_log(simpleomero_log_error,
+            "Problem writing plane: " << failed.at(i).plane
+            << " channel: " << failed.at(i).channel
+            << " time point: " << failed.at(i).time_point << "!!!!"
+        );
+    }
+    return failed.empty() ? 0 : -1;
 }
 
 
@@ -509,28 +949,28 @@ int omero2cv::image::write_plane(
     const cv::Mat &data, const int &timepoint,
     const int &channel, const int &plane)
 {
-    simple_omero::logger *log = new simple_omero::logger();
     if (this->pixel_store->size_z < plane) {
         std::cout << "\twrite_plane: ";
         std::cout << this->size_z << " " << plane << "\n";
         std::cout << "\tPlane index wrong!!!!!!\n";
         return -1;
     }
-    unsigned char *buffer;
     cv::Mat image_temp;
-    std::cout << log->date_time_now()
-              << " Writing Image: " << this->omero_image->id
-              << " time point: " << timepoint
-              << " channel: " << channel
-              << " plane: " << plane
-              << "\n";
-    image_temp = data.clone();
-    if (this->pixel_type_bpp > 1) {
-        cv::flip(image_temp, image_temp, -1);
-    }
-    buffer = reinterpret_cast<unsigned char *>(image_temp.data);
-    this->omero_image->write_plane(
-        buffer, this->pixel_type_bpp, timepoint, channel, plane);
+    simpleomero_log(simpleomero_log_debug,
+        "Writing Image: " << this->omero_image->id
+        << " time point: " << timepoint << " channel: " << channel
+        << " plane: " << plane
+    );
+    image_temp = continuous(data);
+    try {
+        this->omero_image->write_plane(
+            image_temp.data, this->pixel_type_bpp, timepoint, channel, plane
+        );
+    } catch (...) {
+        this->drop_cached_planes();
+        throw;
+    }
+    this->drop_cached_planes();
     return 0;
 }
 
@@ -563,28 +1003,7 @@ void omero2cv::image::allocate_pixel_store()
     this->pixel_store->pixel_size_z = this->pixel_size_z;
     this->pixel_store->z_scaling = this->pixel_size_z / this->pixel_size_x;
     
-    plane_store *planes;
-    channel_store *temp = new channel_store();
-
-    for (int t = 0; t < this->pixel_store_timepoints; t++) {
-        temp = new channel_store();
-        temp->size_x = this->pixel_store->size_x;
-        temp->size_y = this->pixel_store->size_y;
-        temp->size_z = this->pixel_store->size_z;
-        temp->pixel_size_x = this->pixel_store->pixel_size_x;
-        temp->pixel_size_y = this->pixel_store->pixel_size_y;
-        temp->pixel_size_z = this->pixel_store->pixel_size_z;
-        for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
-             planes = new plane_store(
-                this->pixel_store->pixel_size_x,
-                this->pixel_store->pixel_size_y,
-                this->pixel_store->pixel_size_z
-            );
-            planes->resize(this->pixel_store->size_z);
-            temp->push_back(planes);
-        }
-        this->pixel_store->push_back(temp);
-    }
+    this->allocate_planes();
 }
 
 
@@ -614,29 +1033,8 @@ void omero2cv::image::allocate_pixel_store(const int timepoint)
     this->pixel_store->pixel_size_z = this->pixel_size_z;
     this->pixel_store->z_scaling = this->pixel_size_z / this->pixel_size_x;
     
-    plane_store *planes;
-    channel_store *temp = new channel_store();
-
-    for (int t = 0; t < this->pixel_store_timepoints; t++) {
-        temp = new channel_store();
-        temp->size_x = this->pixel_store->size_x;
-        temp->size_y = this->pixel_store->size_y;
-        temp->size_z = this->pixel_store->size_z;
-        temp->pixel_size_x = this->pixel_store->pixel_size_x;
-        temp->pixel_size_y = this->pixel_store->pixel_size_y;
-        temp->pixel_size_z = this->pixel_store->pixel_size_z;
-        for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
-            planes = new plane_store(
-                this->pixel_store->pixel_size_x,
-                this->pixel_store->pixel_size_y,
-                this->pixel_store->pixel_size_z
-            );
-            planes->resize(this->pixel_store->size_z);
-            temp->push_back(planes);
-        }
-        this->pixel_store->push_back(temp);
-    }
-}
+    this->allocate_planes();
+}
 
 
 void omero2cv::image::allocate_pixel_store(
@@ -664,28 +1062,7 @@ void omero2cv::image::allocate_pixel_store(
     this->pixel_store->pixel_size_z = this->pixel_size_z;
     this->pixel_store->z_scaling = this->pixel_size_z / this->pixel_size_x;
     
-    plane_store *planes;
-    channel_store *temp = new channel_store();
-
-    for (int t = 0; t < this->pixel_store_timepoints; t++) {
-        temp = new channel_store();
-        temp->size_x = this->pixel_store->size_x;
-        temp->size_y = this->pixel_store->size_y;
-        temp->size_z = this->pixel_store->size_z;
-        temp->pixel_size_x = this->pixel_store->pixel_size_x;
-        temp->pixel_size_y = this->pixel_store->pixel_size_y;
-        temp->pixel_size_z = this->pixel_store->pixel_size_z;
-        for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
-            planes = new plane_store(
-                this->pixel_store->pixel_size_x,
-                this->pixel_store->pixel_size_y,
-                this->pixel_store->pixel_size_z
-            );
-            planes->resize(this->pixel_store->size_z);
-            temp->push_back(planes);
-        }
-        this->pixel_store->push_back(temp);
-    }
+    this->allocate_planes();
 }
 
 
@@ -712,28 +1089,7 @@ void omero2cv::image::allocate_pixel_store(
     this->pixel_store->pixel_size_z = this->pixel_size_z;
     this->pixel_store->z_scaling = this->pixel_size_z / this->pixel_size_x;
     
-    plane_store *planes;
-    channel_store *temp = new channel_store();
-    
-    for (int t = 0; t < this->pixel_store_timepoints; t++) {
-        temp = new channel_store();
-        temp->size_x = this->pixel_store->size_x;
-        temp->size_y = this->pixel_store->size_y;
-        temp->size_z = this->pixel_store->size_z;
-        temp->pixel_size_x = this->pixel_store->pixel_size_x;
-        temp->pixel_size_y = this->pixel_store->pixel_size_y;
-        temp->pixel_size_z = this->pixel_store->pixel_size_z;
-        for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
-            planes = new plane_store(
-                this->pixel_store->pixel_size_x,
-                this->pixel_store->pixel_size_y,
-                this->pixel_store->pixel_size_z
-            );
-            planes->resize(this->pixel_store->size_z);
-            temp->push_back(planes);
-        }
-        this->pixel_store->push_back(temp);
-    }
+    this->allocate_planes();
 }
 
 
@@ -761,9 +1117,170 @@ void omero2cv::image::allocate_pixel_store(
     this->pixel_store->pixel_size_z = this->pixel_size_z;
     this->pixel_store->z_scaling = this->pixel_size_z / this->pixel_size_x;
     
+    this->allocate_planes();
+}
+
+
+void omero2cv::image::allocate_pixel_store(
+    const simple_omero::hyper_cube &cube)
+{
+    if (!this->omero_image->contains(cube)) {
+        std::cout << "\tallocate_pixel_store: Hypercube empty or outside "
+                  << "the image!!!!\n";
+        return;
+    }
+    this->pixel_store = new image_store();
+
+    this->timepoint_list.clear();
+    this->channel_list.clear();
+    this->plane_list.clear();
+    for (int t = 0; t < cube.extent(simple_omero::hyper_cube::t); t++) {
+        this->timepoint_list.push_back(
+            cube.offset[simple_omero::hyper_cube::t] +
+            t * cube.step[simple_omero::hyper_cube::t]
+        );
+    }
+    for (int c = 0; c < cube.extent(simple_omero::hyper_cube::c); c++) {
+        this->channel_list.push_back(
+            cube.offset[simple_omero::hyper_cube::c] +
+            c * cube.step[simple_omero::hyper_cube::c]
+        );
+    }
+    for (int z = 0; z < cube.extent(simple_omero::hyper_cube::z); z++) {
+        this->plane_list.push_back(
+            cube.offset[simple_omero::hyper_cube::z] +
+            z * cube.step[simple_omero::hyper_cube::z]
+        );
+    }
+
+    this->pixel_store_timepoints = this->timepoint_list.size();
+    this->pixel_store->number_of_channels = this->channel_list.size();
+    this->pixel_store->size_x = cube.extent(simple_omero::hyper_cube::x);
+    this->pixel_store->size_y = cube.extent(simple_omero::hyper_cube::y);
+    this->pixel_store->size_z = this->plane_list.size();
+    // Subsampled pixels cover more of the sample.
+    this->pixel_store->pixel_size_x =
+        this->pixel_size_x * cube.step[simple_omero::hyper_cube::x];
+    this->pixel_store->pixel_size_y =
+        this->pixel_size_y * cube.step[simple_omero::hyper_cube::y];
+    this->pixel_store->pixel_size_z =
+        this->pixel_size_z * cube.step[simple_omero::hyper_cube::z];
+    this->pixel_store->z_scaling =
+        this->pixel_store->pixel_size_z / this->pixel_store->pixel_size_x;
+
+    this->allocate_planes();
+}
+
+
+int omero2cv::image::read_hyper_cube(const simple_omero::hyper_cube &cube)
+{
+    if (this->pixel_store == NULL || !this->omero_image->contains(cube)) {
+        std::cout << "\tread_hyper_cube: No pixel_store or hypercube "
+                  << "outside the image!!!!\n";
+        return -1;
+    }
+    if (this->pixel_type_cv < 0 ||
+        this->pixel_store_timepoints !=
+            cube.extent(simple_omero::hyper_cube::t) ||
+        this->pixel_store->number_of_channels !=
+            cube.extent(simple_omero::hyper_cube::c) ||
+        this->pixel_store->size_z !=
+            cube.extent(simple_omero::hyper_cube::z) ||
+        this->pixel_store->size_x !=
+            cube.extent(simple_omero::hyper_cube::x) ||
+        this->pixel_store->size_y !=
+            cube.extent(simple_omero::hyper_cube::y)) {
+        std::cout << "\tread_hyper_cube: pixel_store does not match the "
+                  << "hypercube!!!!\n";
+        return -1;
+    }
+    std::vector<Ice::Byte> bytes;
+    try {
+        this->omero_image->get_hyper_cube_bytes(
+            cube, bytes, this->pixel_type_bpp
+        );
+    } catch (...) {
+        std::cout << "\tread_hyper_cube: Problem reading hypercube!!!!\n";
+        return -1;
+    }
+    size_t plane_pixels = (size_t) this->pixel_store->size_x *
+        this->pixel_store->size_y;
+    size_t plane_size = plane_pixels * this->pixel_type_bpp;
+    const unsigned char *source =
+        reinterpret_cast<const unsigned char *>(&bytes[0]);
+    simple_omero::rpc_timer timer(simple_omero::rpc_decode, bytes.size());
+    // The server's XYZCT order is the arena's, so convert in one go.
+    if (this->pixel_store->arena != NULL &&
+        this->pixel_store->arena->dimension_order == "XYZCT") {
+        this->swap_kernel(
+            source, this->pixel_store->arena->data(), cube.count()
+        );
+        return 0;
+    }
+    for (int t = 0; t < this->pixel_store_timepoints; t++) {
+        for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
+            for (int z = 0; z < this->pixel_store->size_z; z++) {
+                cv::Mat &plane = this->pixel_store->t(t)->c(c)->z(z);
+                plane.create(
+                    this->pixel_store->size_y, this->pixel_store->size_x,
+                    this->pixel_type_cv
+                );
+                this->swap_kernel(source, plane.data, plane_pixels);
+                source += plane_size;
+            }
+        }
+    }
+    return 0;
+}
+
+
+int omero2cv::image::read_hyper_cube(
+    const simple_omero::hyper_cube &cube, cv::Mat &destination)
+{
+    if (this->pixel_type_cv < 0) {
+        std::cout << "\tread_hyper_cube: Type not supported!!!!\n";
+        return -1;
+    }
+    if (!this->omero_image->contains(cube)) {
+        std::cout << "\tread_hyper_cube: Hypercube empty or outside the "
+                  << "image!!!!\n";
+        return -1;
+    }
+    int sizes[5];
+    sizes[0] = cube.extent(simple_omero::hyper_cube::t);
+    sizes[1] = cube.extent(simple_omero::hyper_cube::c);
+    sizes[2] = cube.extent(simple_omero::hyper_cube::z);
+    sizes[3] = cube.extent(simple_omero::hyper_cube::y);
+    sizes[4] = cube.extent(simple_omero::hyper_cube::x);
+    if (!destination.isContinuous()) {
+        destination.release();
+    }
+    destination.create(5, sizes, this->pixel_type_cv);
+    try {
+        this->omero_image->get_raw_pixels_hyper_cube(
+            destination.data, cube, this->pixel_type_bpp
+        );
+    } catch (...) {
+        std::cout << "\tread_hyper_cube: Problem reading hypercube!!!!\n";
+        return -1;
+    }
+    return 0;
+}
+
+
+void omero2cv::image::allocate_planes()
+{
     plane_store *planes;
-    channel_store *temp = new channel_store();
-    
+    channel_store *temp;
+    if (this->use_arena && this->pixel_type_cv >= 0) {
+        this->pixel_store->arena = new pixel_arena(
+            this->pixel_store->size_x * this->pixel_store->size_y
+                * this->pixel_type_bpp,
+            this->pixel_store->size_z, this->pixel_store->number_of_channels,
+            this->pixel_store_timepoints, this->arena_dimension_order,
+            this->arena_huge_pages
+        );
+    }
     for (int t = 0; t < this->pixel_store_timepoints; t++) {
         temp = new channel_store();
         temp->size_x = this->pixel_store->size_x;
@@ -778,7 +1295,26 @@ void omero2cv::image::allocate_pixel_store(
                 this->pixel_store->pixel_size_y,
                 this->pixel_store->pixel_size_z
             );
-            planes->resize(this->pixel_store->size_z);
+            if (this->pixel_type_cv < 0) {
+                // Type not supported by OpenCV, nothing to allocate.
+                planes->resize(this->pixel_store->size_z);
+            } else if (this->pixel_store->arena != NULL) {
+                planes->resize(this->pixel_store->size_z);
+                for (int z = 0; z < this->pixel_store->size_z; z++) {
+                    planes->z(z) = cv::Mat(
+                        this->pixel_store->size_y, this->pixel_store->size_x,
+                        this->pixel_type_cv,
+                        this->pixel_store->arena->plane(z, c, t)
+                    );
+                }
+            } else {
+                // Sized up front so read_image decodes straight into
+                // the planes.
+                planes->allocate_mat(
+                    this->pixel_store->size_x, this->pixel_store->size_y,
+                    this->pixel_store->size_z, this->pixel_type_cv
+                );
+            }
             temp->push_back(planes);
         }
         this->pixel_store->push_back(temp);
@@ -788,6 +1324,9 @@ void omero2cv::image::allocate_pixel_store(
 
 void omero2cv::image::clear_pixel_store()
 {
+    if (this->pixel_store == NULL) {
+        return;
+    }
     for (int t = 0; t < this->pixel_store->size(); t++) {
         for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
             for (int z = 0; z < this->pixel_store->size_z; z++) {
@@ -800,52 +1339,547 @@ void omero2cv::image::clear_pixel_store()
         delete this->pixel_store->t(t);
     }
     this->pixel_store->clear();
+    // Also frees the arena the planes pointed into, if any.
     delete this->pixel_store;
+    this->pixel_store = NULL;
     this->timepoint_list.clear();
     this->channel_list.clear();
     this->plane_list.clear();
     this->pixel_store_timepoints = this->timepoint_list.size();
-    this->pixel_store->number_of_channels = this->channel_list.size();
-    this->pixel_store->size_z = this->plane_list.size();
-    this->pixel_store->pixel_size_z = 0;
 }
 
 
-void omero2cv::image::read_image()
+int omero2cv::image::read_image()
 {
-    simple_omero::logger *log = new simple_omero::logger();
-    int timepoint, channel, plane;
-    cv::Mat buffer;
-    unsigned char *image_cast =
-        (unsigned char *) malloc (
-            this->omero_image->pixel_store->getPlaneSize()
-    );
+    std::vector<simple_omero::plane_index> planes;
+    std::vector<cv::Mat *> destinations;
+    simple_omero::plane_index index;
     for (int t = 0; t < this->pixel_store_timepoints; t++) {
-        timepoint = this->timepoint_list.at(t);
         for (int c = 0; c < this->pixel_store->number_of_channels; c++) {
-            channel = this->channel_list.at(c);
-            std::cout << log->date_time_now()
-                      << " Reading Image: " << this->omero_image->id
-                      << " time point: " << timepoint
-                      << " channel: " << channel
-                      << "\n";
             for (int z = 0; z < this->pixel_store->size_z; z++) {
-                plane = this->plane_list.at(z);
-                this->omero_image->get_raw_pixels(
-                    image_cast, plane, channel, timepoint, this->pixel_type_bpp
-                );
-                buffer = cv::Mat(
-                    this->size_y, this->size_x, this->pixel_type_cv, image_cast
+                index.plane = this->plane_list.at(z);
+                index.channel = this->channel_list.at(c);
+                index.time_point = this->timepoint_list.at(t);
+                cv::Mat *destination = &this->pixel_store->t(t)->c(c)->z(z);
+                if (this->read_cached_plane(index, destination)) {
+                    continue;
+                }
+                planes.push_back(index);
+                destinations.push_back(destination);
+            }
+        }
+    }
+    if (planes.empty()) {
+        return 0;
+    }
+    if (this->number_of_readers > 1 && this->omero_image->pixel_store) {
+        simpleomero_log(simpleomero_log_debug,
+            "Reading Image: " << this->omero_image->id
+            << " with " << this->number_of_readers << " readers"
+        );
+        if (this->read_image_parallel(planes, destinations) != 0) {
+            return -1;
+        }
+        this->write_cached_planes(planes, destinations);
+        return 0;
+    }
+    const Ice::Byte *bytes;
+    size_t size;
+    size_t read = 0;
+    try {
+        simple_omero::plane_prefetcher prefetcher(
+            this->omero_image->source, planes, this->prefetch_depth,
+            this->omero_image->size_z,
+            this->omero_image->number_of_channels, this->block_plane_size()
+        );
+        // Planes come back in the order they were listed above, decoded
+        // straight out of the stacks and time points they arrive in.
+        for (; prefetcher.next(bytes, size, index); read++) {
+            if (read == 0 || index.plane == this->plane_list.at(0)) {
+                simpleomero_log(simpleomero_log_debug,
+                    "Reading Image: " << this->omero_image->id
+                    << " time point: " << index.time_point
+                    << " channel: " << index.channel
                 );
-                if (this->pixel_type_bpp > 1) {
-                    // Second part of conversion from BIG_ENDIAN (OMERO)
-                    // to LITTLE_ENDIAN (OpenCV), first part in get_raw_pixels
-                    cv::flip(buffer, buffer, -1);
+            }
+            decode_plane(
+                bytes, size, this->size_x, this->size_y,
+                this->pixel_type_cv, this->swap_kernel, destinations.at(read)
+            );
+        }
+    } catch (...) {
+        std::cout << "\tProblem reading image " << this->id << "!!!!\n";
+        return -1;
+    }
+    if (read != planes.size()) {
+        std::cout << "\tOnly " << read << " of " << planes.size()
+                  << " planes of image " << this->id << " read!!!!\n";
+        return -1;
+    }
+    this->write_cached_planes(planes, destinations);
+    return 0;
+}
+
+
+int omero2cv::image::project(
+    const int &mode, const int &timepoint, const int &channel,
+    cv::Mat &projection)
+{
+    std::vector<cv::Mat> projections;
+    if (this->project_channels(
+            mode, timepoint, std::vector<int>(1, channel),
+            projections) != 0) {
+        return -1;
+    }
+    projection = projections.at(0);
+    return 0;
+}
+
+
+int omero2cv::image::project(
+    const int &mode, const int &timepoint, plane_store &projections)
+{
+    std::vector<int> channels;
+    for (int c = 0; c < this->number_of_channels; c++) {
+        channels.push_back(c);
+    }
+    if (this->project_channels(mode, timepoint, channels, projections) != 0) {
+        return -1;
+    }
+    projections.pixel_size_x = this->pixel_size_x;
+    projections.pixel_size_y = this->pixel_size_y;
+    projections.pixel_size_z = this->pixel_size_z;
+    projections.z_scaling = this->z_scaling;
+    return 0;
+}
+
+
+int omero2cv::image::project_channels(
+    const int &mode, const int &timepoint, const std::vector<int> &channels,
+    std::vector<cv::Mat> &projections)
+{
+    if (mode < o2cv_projection_max || mode > o2cv_projection_stddev ||
+        this->pixel_type_cv < 0) {
+        simpleomero_log(simpleomero_log_error,
+            "project: Projection mode or pixel type not supported!!!!"
+        );
+        return -1;
+    }
+    if (timepoint < 0 || timepoint >= this->number_of_timepoints ||
+        this->size_z < 1) {
+        simpleomero_log(simpleomero_log_error,
+            "project: Time point out of range!!!!"
+        );
+        return -1;
+    }
+    for (size_t c = 0; c < channels.size(); c++) {
+        if (channels.at(c) < 0 ||
+            channels.at(c) >= this->number_of_channels) {
+            simpleomero_log(simpleomero_log_error,
+                "project: Channel out of range!!!!"
+            );
+            return -1;
+        }
+    }
+    std::vector<projection_accumulator> accumulators(channels.size());
+    std::vector<simple_omero::plane_index> planes;
+    std::vector<size_t> owners;
+    simple_omero::plane_index index;
+    index.time_point = timepoint;
+    cv::Mat plane;
+    try {
+        for (size_t c = 0; c < channels.size(); c++) {
+            index.channel = channels.at(c);
+            for (int z = 0; z < this->size_z; z++) {
+                index.plane = z;
+                if (this->read_cached_plane(index, &plane)) {
+                    accumulators.at(c).fold(mode, plane);
+                    continue;
                 }
-                this->pixel_store->t(t)->c(c)->z(z) = buffer.clone();
+                planes.push_back(index);
+                owners.push_back(c);
             }
         }
+        if (!planes.empty()) {
+            // Plane by plane: getStack would hold the whole stack.
+            simple_omero::plane_prefetcher prefetcher(
+                this->omero_image->source, planes, this->prefetch_depth
+            );
+            const Ice::Byte *bytes;
+            size_t size;
+            for (size_t i = 0; prefetcher.next(bytes, size, index); i++) {
+                decode_plane(
+                    bytes, size, this->size_x, this->size_y,
+                    this->pixel_type_cv, this->swap_kernel, &plane
+                );
+                accumulators.at(owners.at(i)).fold(mode, plane);
+            }
+        }
+    } catch (...) {
+        simpleomero_log(simpleomero_log_error,
+            "project: Problem reading planes of image " << this->id << "!!!!"
+        );
+        return -1;
+    }
+    projections.resize(channels.size());
+    for (size_t c = 0; c < channels.size(); c++) {
+        accumulators.at(c).result(mode, projections.at(c));
     }
-    delete image_cast;
-    delete log;
+    return 0;
+}
+
+
+int omero2cv::image::open_pixel_source(
+    simple_omero::pixel_source *source)
+{
+    if (this->omero_image->open_pixel_source(source) != 0) {
+        std::cout << "\tPixel source for image " << this->id
+                  << " missing or not open!!!!\n";
+        return -1;
+    }
+    return 0;
+}
+
+
+int omero2cv::image::get_resolution_levels()
+{
+    try {
+        return this->omero_image->get_resolution_levels();
+    } catch (...) {
+        std::cout << "\tProblem getting resolution levels of image "
+                  << this->id << "!!!!\n";
+        return 1;
+    }
+}
+
+
+int omero2cv::image::set_resolution_level(const int &level)
+{
+    try {
+        this->omero_image->set_resolution_level(level);
+    } catch (...) {
+        std::cout << "\tProblem setting resolution level " << level
+                  << " of image " << this->id << "!!!!\n";
+        return -1;
+    }
+    this->resolution_level = this->omero_image->resolution_level;
+    this->size_x = this->omero_image->level_size_x;
+    this->size_y = this->omero_image->level_size_y;
+    // Pixels cover more of the sample at lower levels.
+    this->pixel_size_x = this->omero_image->pixel_size_x *
+        this->omero_image->size_x / this->size_x;
+    this->pixel_size_y = this->omero_image->pixel_size_y *
+        this->omero_image->size_y / this->size_y;
+    this->z_scaling = this->pixel_size_z / this->pixel_size_x;
+    return 0;
+}
+
+
+void omero2cv::image::set_disk_cache(omero2cv::disk_cache *cache)
+{
+    this->cache = cache;
+    if (this->cache != NULL) {
+        this->cache->open(
+            this->omero_image->pixels_id, this->omero_image->update_event
+        );
+    }
+}
+
+
+bool omero2cv::image::read_cached_plane(
+    const simple_omero::plane_index &index, cv::Mat *destination)
+{
+    simple_omero::plane_cache *memory = simple_omero::plane_cache::shared;
+    // Planes of pixels whose update event is unknown could be stale.
+    bool disk = this->cache != NULL && this->omero_image->update_event >= 0;
+    if ((memory == NULL && !disk) || this->pixel_type_cv < 0) {
+        return false;
+    }
+    if (!destination->isContinuous()) {
+        destination->release();
+    }
+    destination->create(this->size_y, this->size_x, this->pixel_type_cv);
+    if (memory != NULL && memory->fetch(
+            this->omero_image->pixels_id, this->resolution_level, index,
+            destination->data, this->size_x, this->size_y,
+            this->pixel_type_bpp)) {
+        return true;
+    }
+    if (!disk || !this->cache->read(
+            this->omero_image->pixels_id, this->omero_image->update_event,
+            this->resolution_level, index, *destination)) {
+        return false;
+    }
+    if (memory != NULL) {
+        memory->store(
+            this->omero_image->pixels_id, this->resolution_level, index,
+            destination->data, this->size_x, this->size_y,
+            this->pixel_type_bpp
+        );
+    }
+    return true;
+}
+
+
+void omero2cv::image::drop_cached_planes()
+{
+    if (this->cache == NULL) {
+        return;
+    }
+    // The planes on disk are keyed by the update event read at open, which
+    // the write made stale; the memory cache is written through instead.
+    this->cache->invalidate(this->omero_image->pixels_id);
+    if (this->omero_image->reload_update_event(this->session) >= 0) {
+        this->cache->open(
+            this->omero_image->pixels_id, this->omero_image->update_event
+        );
+    }
+}
+
+
+void omero2cv::image::write_cached_planes(
+    const std::vector<simple_omero::plane_index> &planes,
+    const std::vector<cv::Mat *> &destinations)
+{
+    simple_omero::plane_cache *memory = simple_omero::plane_cache::shared;
+    bool disk = this->cache != NULL && this->omero_image->update_event >= 0;
+    for (size_t i = 0; i < planes.size(); i++) {
+        if (memory != NULL && destinations.at(i)->isContinuous()) {
+            memory->store(
+                this->omero_image->pixels_id, this->resolution_level,
+                planes.at(i), destinations.at(i)->data, this->size_x,
+                this->size_y, this->pixel_type_bpp
+            );
+        }
+        if (disk) {
+            this->cache->write(
+                this->omero_image->pixels_id, this->omero_image->update_event,
+                this->resolution_level, planes.at(i), *destinations.at(i)
+            );
+        }
+    }
+}
+
+
+int omero2cv::image::read_image_parallel(
+    const std::vector<simple_omero::plane_index> &planes,
+    const std::vector<cv::Mat *> &destinations)
+{
+    std::vector<plane_reader_ptr> readers;
+    omero::api::ServiceFactoryPrx reader_session;
+    try {
+        for (int r = 0; r < this->number_of_readers; r++) {
+            if (this->reader_sessions.empty()) {
+                reader_session = this->session;
+            } else {
+                reader_session = this->reader_sessions.at(
+                    r % this->reader_sessions.size()
+                );
+            }
+            readers.push_back(
+                new plane_reader(
+                    this->omero_image->create_pixel_store(reader_session),
+                    this->prefetch_depth, this->size_x, this->size_y,
+                    this->pixel_type_cv, this->swap_kernel,
+                    this->omero_image->size_z,
+                    this->omero_image->number_of_channels,
+                    this->block_plane_size()
+                )
+            );
+        }
+    } catch (...) {
+        std::cout << "\tProblem opening RawPixelsStores for image "
+                  << this->id << "!!!!\n";
+        for (size_t r = 0; r < readers.size(); r++) {
+            try {
+                readers.at(r)->pixel_store->close();
+            } catch (...) {
+            }
+        }
+        return -1;
+    }
+    // Hand out whole stacks if there are enough to go round, so they can
+    // be read with getStack; interleave single planes otherwise. Every
+    // reader writes only to its own pixel_store slots.
+    size_t group = this->pixel_store->size_z;
+    if (group < 1 || planes.size() / group < readers.size()) {
+        group = 1;
+    }
+    for (size_t i = 0; i < planes.size(); i++) {
+        readers.at(i / group % readers.size())->add(
+            planes.at(i), destinations.at(i)
+        );
+    }
+    std::vector<IceUtil::ThreadControl> threads;
+    for (size_t r = 0; r < readers.size(); r++) {
+        threads.push_back(readers.at(r)->start());
+    }
+    int status = 0;
+    for (size_t r = 0; r < readers.size(); r++) {
+        threads.at(r).join();
+        try {
+            readers.at(r)->pixel_store->close();
+        } catch (...) {
+        }
+        if (readers.at(r)->failed) {
+            std::cout << "\tProblem reading planes with reader " << r
+                      << "!!!!\n";
+            status = -1;
+        }
+    }
+    return status;
+}
+
+
+void omero2cv::image::get_tile_size(int &width, int &height)
+{
+    if (this->tile_width <= 0 || this->tile_height <= 0) {
+        this->omero_image->get_tile_size(this->tile_width, this->tile_height);
+    }
+    if (this->tile_width <= 0 || this->tile_height <= 0) {
+        // No usable tile size from the server: read strips of whole rows
+        // about as large as OMERO's default 256 x 256 tile, so tile loops
+        // never step by zero.
+        this->tile_width = this->size_x > 0 ? this->size_x : 1;
+        this->tile_height = std::max(
+            1, std::min(this->size_y, 256 * 256 / this->tile_width)
+        );
+    }
+    width = this->tile_width;
+    height = this->tile_height;
+}
+
+
+int omero2cv::image::read_region(
+    const int &timepoint, const int &channel, const int &plane,
+    const cv::Rect &region, cv::Mat &destination)
+{
+    cv::Rect bounds = region & cv::Rect(0, 0, this->size_x, this->size_y);
+    if (bounds.area() == 0 || this->pixel_type_cv < 0) {
+        std::cout << "\tread_region: Region outside the plane or type not "
+                  << "supported!!!!\n";
+        return -1;
+    }
+    destination.create(bounds.height, bounds.width, this->pixel_type_cv);
+    try {
+        tile_iterator tiles(*this, timepoint, channel, plane, bounds);
+        cv::Mat tile;
+        cv::Rect roi;
+        while (tiles.next(tile, roi)) {
+            cv::Mat target = destination(
+                cv::Rect(roi.x - bounds.x, roi.y - bounds.y,
+                         roi.width, roi.height)
+            );
+            tile.copyTo(target);
+        }
+    } catch (...) {
+        std::cout << "\tread_region: Problem reading tiles!!!!\n";
+        return -1;
+    }
+    return 0;
+}
+
+
+omero2cv::tile_iterator::tile_iterator(
+    image &source, const int &timepoint, const int &channel,
+    const int &plane, const cv::Rect &region)
+{
+    this->cv_type = source.pixel_type_cv;
+    this->swap = source.swap_kernel;
+    int tile_width, tile_height;
+    source.get_tile_size(tile_width, tile_height);
+    cv::Rect bounds = region & cv::Rect(0, 0, source.size_x, source.size_y);
+    std::vector<simple_omero::tile_index> tiles;
+    simple_omero::tile_index index;
+    index.plane = plane;
+    index.channel = channel;
+    index.time_point = timepoint;
+    if (bounds.area() > 0) {
+        // Start on the tile grid so every request maps onto whole tiles
+        // on the server.
+        int first_x = bounds.x / tile_width * tile_width;
+        int first_y = bounds.y / tile_height * tile_height;
+        for (int y = first_y; y < bounds.y + bounds.height; y += tile_height) {
+            for (int x = first_x; x < bounds.x + bounds.width;
+                 x += tile_width) {
+                cv::Rect tile =
+                    cv::Rect(x, y, tile_width, tile_height) & bounds;
+                index.x = tile.x;
+                index.y = tile.y;
+                index.width = tile.width;
+                index.height = tile.height;
+                tiles.push_back(index);
+            }
+        }
+    }
+    this->number_of_tiles = tiles.size();
+    this->prefetcher = new simple_omero::tile_prefetcher(
+        source.omero_image->source, tiles, source.prefetch_depth
+    );
+}
+
+
+omero2cv::tile_iterator::~tile_iterator()
+{
+    delete this->prefetcher;
+}
+
+
+bool omero2cv::tile_iterator::next(cv::Mat &tile, cv::Rect &roi)
+{
+    std::vector<Ice::Byte> bytes;
+    simple_omero::tile_index index;
+    if (!this->prefetcher->next(bytes, index)) {
+        return false;
+    }
+    roi = cv::Rect(index.x, index.y, index.width, index.height);
+    if (!tile.isContinuous()) {
+        tile.release();
+    }
+    tile.create(index.height, index.width, this->cv_type);
+    if (bytes.size() < (size_t) index.width * index.height *
+        tile.elemSize()) {
+        throw std::length_error("Short tile");
+    }
+    this->swap(
+        reinterpret_cast<const unsigned char *>(&bytes[0]), tile.data,
+        (size_t) index.width * index.height
+    );
+    return true;
+}
+
+
+omero2cv::plane_iterator::plane_iterator(image &source)
+{
+    this->size_x = source.size_x;
+    this->size_y = source.size_y;
+    this->cv_type = source.pixel_type_cv;
+    this->swap = source.swap_kernel;
+    this->number_of_planes = source.timepoint_list.size() *
+        source.channel_list.size() * source.plane_list.size();
+    this->prefetcher = source.create_plane_prefetcher();
+}
+
+
+omero2cv::plane_iterator::~plane_iterator()
+{
+    delete this->prefetcher;
+}
+
+
+bool omero2cv::plane_iterator::next(
+    cv::Mat &plane, simple_omero::plane_index &index)
+{
+    const Ice::Byte *bytes;
+    size_t size;
+    if (!this->prefetcher->next(bytes, size, index)) {
+        return false;
+    }
+    // Allocates only on the first plane; later planes overwrite it.
+    decode_plane(
+        bytes, size, this->size_x, this->size_y, this->cv_type, this->swap,
+        &this->buffer
+    );
+    plane = this->buffer;
+    return true;
 }
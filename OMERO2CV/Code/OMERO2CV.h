@@ -18,8 +18,19 @@
 
 
 #include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <map>
 #include <vector>
+#include <string>
+#include <new>
 #include <SimpleOMERO.h>
+#include "disk_cache.h"
+#include "memory_cache.h"
+#include <IceUtil/Thread.h>
+#include <IceUtil/StaticMutex.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -35,13 +46,79 @@
 #define o2cv_dbl             8
 #define o2cv_complex         9
 #define o2cv_double_complex  10
+/// Number of OMERO pixel types, size of the pixel type tables.
+#define o2cv_number_of_types 11
+
+/// Default number of getPlane requests kept in flight by read_image.
+#define o2cv_default_prefetch_depth 4
+/// Default number of RawPixelsStores read_image reads from.
+#define o2cv_default_number_of_readers 1
+/// Default number of setPlane requests kept in flight by write_image.
+#define o2cv_default_write_depth 4
+
+/// Projection modes of omero2cv::image::project.
+#define o2cv_projection_max    0
+#define o2cv_projection_min    1
+#define o2cv_projection_mean   2
+#define o2cv_projection_sum    3
+#define o2cv_projection_stddev 4
 
 
 namespace omero2cv
 {
 #ifndef _omero2cv_stack_included_
 #define _omero2cv_stack_included_
+    /// \brief Pixel types of an OMERO server, shared by every image opened
+    ///        in a session.
+    /// \details The PixelsType enumeration is fetched once per session, on
+    ///          first use. Conversions then go through static tables
+    ///          indexed by the o2cv_* pixel type defines, with no string
+    ///          comparisons or server calls.
+    class pixel_type_registry
+    {
+    public:
+        /// \brief Gets the registry of a session, creating it on first
+        ///        use. Thread safe.
+        /// \details Registries live until the process exits.
+        /*!
+         * \param session pointer to curent session (Service Factory).
+         * \return the session's registry.
+         */
+        static pixel_type_registry *get(
+            const omero::api::ServiceFactoryPrx &session
+        );
+        /// \brief Gets the o2cv_* index of an OMERO pixel type.
+        /*!
+         * \return index; -1 if the type is not listed.
+         */
+        int index_of(const omero::model::PixelsTypePtr &omero_type);
+        /// \brief Gets the o2cv_* index of an OpenCV pixel type.
+        /*!
+         * \return index; -1 if OMERO has no such type.
+         */
+        static int index_of(const int &cv_type);
+        /// \brief Gets the OMERO pixel type at an o2cv_* index.
+        /*!
+         * \return the pixel type; null if the server does not list it.
+         */
+        omero::model::PixelsTypePtr omero_type(const int &index);
+        /// OpenCV type of each o2cv_* index; -1 if OpenCV has none.
+        static const int cv_types[o2cv_number_of_types];
+        /// Bytes per pixel of each o2cv_* index.
+        static const int bpp[o2cv_number_of_types];
+        /// OMERO name of each o2cv_* index.
+        static const char *const names[o2cv_number_of_types];
+    private:
+        /// Fetches the session's PixelsType enumeration.
+        pixel_type_registry(const omero::api::ServiceFactoryPrx &session);
+        /// OMERO pixel types, by o2cv_* index.
+        std::vector<omero::model::PixelsTypePtr> omero_pixels;
+        /// o2cv_* index of each pixel type ID.
+        std::map<long long, int> indices;
+    };
+
     /// \brief OMERO to OpenCV Image type converter.
+    /// \details Thin wrapper around the session's pixel_type_registry.
     class type_converter
     {
     public:
@@ -56,10 +133,8 @@ namespace omero2cv
         /// Get bytes per pixel for OMERO pixel type.
         int get_bpp(omero::model::PixelsTypePtr omero_type);
     private:
-        /// Vector holding OMERO pixel types fro conversion.
-        /// Populated by the constructor.
-        std::vector<omero::model::PixelsTypePtr> omero_pixels;
-        
+        /// Pixel types of the session. Not owned.
+        pixel_type_registry *registry;
     };
 #endif //_omero2cv_stack_included_
 
@@ -86,6 +161,12 @@ namespace omero2cv
             const int &width, const int &height,
             const int &depth, const int &cv_type
         );
+        /// Resizes the store to depth planes and allocates every plane
+        /// without initialising the pixels.
+        void allocate_mat(
+            const int &width, const int &height,
+            const int &depth, const int &cv_type
+        );
         /// Physical pixel size in X dimension.
         double pixel_size_x;
         /// Physical pixel size in Y dimension.
@@ -129,10 +210,79 @@ namespace omero2cv
 #endif //_omerocv_channel_store_included_
 
 
+#ifndef _omero2cv_pixel_arena_included_
+#define _omero2cv_pixel_arena_included_
+    /// \brief Single aligned allocation holding every plane of an
+    ///        image_store.
+    /// \details Planes are laid out back to back in an OMERO dimension
+    ///          order, e.g. "XYZCT" stores all z planes of a channel next to
+    ///          each other (TCZYX). The image_store planes are cv::Mat
+    ///          headers pointing into the arena, so they stay valid only as
+    ///          long as the arena.
+    class pixel_arena {
+    public:
+        /// Constructor. Allocates the arena.
+        /*!
+         * \param plane_size number of bytes in one plane.
+         * \param number_of_planes number of z planes.
+         * \param number_of_channels number of channels.
+         * \param number_of_timepoints number of time points.
+         * \param dimension_order "XYZCT", "XYZTC", "XYCZT", "XYCTZ",
+         *        "XYTZC" or "XYTCZ"; anything else falls back to "XYZCT".
+         * \param huge_pages back the arena with huge pages where the
+         *        operating system supports it.
+         */
+        pixel_arena(
+            const size_t &plane_size, const int &number_of_planes,
+            const int &number_of_channels, const int &number_of_timepoints,
+            const std::string &dimension_order, const bool &huge_pages
+        );
+        /// Destructor. Frees the arena.
+        ~pixel_arena();
+        /// Returns the first byte of a plane.
+        /*!
+         * \param z z plane index in the store.
+         * \param c channel index in the store.
+         * \param t time point index in the store.
+         */
+        unsigned char *plane(const int &z, const int &c, const int &t);
+        /// Returns the first byte of the arena.
+        unsigned char *data() {return this->bytes;};
+        /// Returns the number of bytes in the arena.
+        size_t size() const {return this->length;};
+        /// Returns the distance in bytes between consecutive planes along
+        /// dimension 'Z', 'C' or 'T'.
+        size_t stride(const char &dimension) const;
+        /// Dimension order of the planes.
+        std::string dimension_order;
+    private:
+        /// Start of the arena.
+        unsigned char *bytes;
+        /// Size of the arena in bytes.
+        size_t length;
+        /// Size of the mapping, length rounded up to whole huge pages
+        /// for MAP_HUGETLB.
+        size_t mapped_length;
+        /// True if the arena was mapped rather than allocated.
+        bool mapped;
+        /// Distance in bytes between consecutive z planes.
+        size_t stride_z;
+        /// Distance in bytes between consecutive channels.
+        size_t stride_c;
+        /// Distance in bytes between consecutive time points.
+        size_t stride_t;
+    };
+#endif //_omero2cv_pixel_arena_included_
+
+
 #ifndef _omerocv_image_store_included_
 #define _omerocv_image_store_included_
     class image_store : public std::vector<channel_store*> {
     public:
+        /// Constructor.
+        image_store() {this->arena = NULL;};
+        /// Destructor. Frees the arena, if any.
+        ~image_store() {delete this->arena;};
         /// Returns a reference to the plane at position t.
         /*!
          * \param timepoint timepoint to access.
@@ -154,6 +304,13 @@ namespace omero2cv
         double pixel_size_z;
         /// z / x scaling factor.
         double z_scaling;
+        /// Contiguous backing of the planes, or NULL if every plane was
+        /// allocated separately.
+        pixel_arena *arena;
+    private:
+        /// Not copyable, it owns the arena.
+        image_store(const image_store &);
+        image_store &operator=(const image_store &);
     };
 #endif //_omerocv_image_store_included_
 
@@ -163,10 +320,66 @@ namespace omero2cv
     /// \brief Read/Write images to and from OMERO in OpenCV format. 
     class image
     {
+        friend class tile_iterator;
+        friend class plane_iterator;
+        template <typename T> friend class typed_plane_iterator;
         ///
         simple_omero::image *omero_image;
         ///
         type_converter *converter;
+        /// Session the image was opened with.
+        omero::api::ServiceFactoryPrx session;
+        /// byte_swap instantiation for the image's pixel type, chosen once
+        /// so decoding does not dispatch per plane.
+        simple_omero::byte_swap_kernel swap_kernel;
+        /// Creates the channel and plane stores of pixel_store, with every
+        /// plane allocated.
+        void allocate_planes();
+        /// Creates a prefetcher over every plane of timepoint_list,
+        /// channel_list and plane_list, in read_image order, reading
+        /// plane by plane so only prefetch_depth planes are held.
+        simple_omero::plane_prefetcher *create_plane_prefetcher();
+        /// Bytes per plane for getStack/getTimepoint reads; 0 reads
+        /// plane by plane.
+        long long block_plane_size();
+        /// Waits for the planes still in transit, reporting any that
+        /// failed. Returns 0 sucess; -1 Failed.
+        int flush_writer(simple_omero::plane_writer &writer);
+        /// Projects the z planes of each of channels at timepoint into
+        /// projections, one per channel. Returns 0 sucess; -1 Failed.
+        int project_channels(
+            const int &mode, const int &timepoint,
+            const std::vector<int> &channels,
+            std::vector<cv::Mat> &projections
+        );
+        /// Reads the planes with number_of_readers RawPixelsStores.
+        /// Returns 0 sucess; -1 Failed.
+        int read_image_parallel(
+            const std::vector<simple_omero::plane_index> &planes,
+            const std::vector<cv::Mat *> &destinations
+        );
+        /// Local plane cache, NULL if not used. Not owned.
+        disk_cache *cache;
+        /// Reads a plane from simple_omero::plane_cache::shared or the
+        /// local disk cache into destination. Returns false if it is in
+        /// neither.
+        bool read_cached_plane(
+            const simple_omero::plane_index &index, cv::Mat *destination
+        );
+        /// Drops the planes of the pixels from the disk cache after a
+        /// write, and keys the cache with the new update event.
+        void drop_cached_planes();
+        /// Stores planes just read from the server in the caches.
+        void write_cached_planes(
+            const std::vector<simple_omero::plane_index> &planes,
+            const std::vector<cv::Mat *> &destinations
+        );
+        /// Sets up the image from a retrieved simple_omero::image, which
+        /// it takes ownership of.
+        void set_up(
+            const omero::api::ServiceFactoryPrx &session,
+            simple_omero::image *handle
+        );
     public:
         /// Destructor
         ~image();
@@ -179,6 +392,31 @@ namespace omero2cv
             const omero::api::ServiceFactoryPrx &session,
             const int &image_id
         );
+        /// Constructor for reading an image already retrieved with
+        /// simple_omero::image::load_images.
+        /*!
+         * \param session pointer to curent session (Service Factory).
+         * \param handle retrieved image; deleted with this image.
+         */
+        image(
+            const omero::api::ServiceFactoryPrx &session,
+            simple_omero::image *handle
+        );
+        /// \brief Retrieves many images, batching the metadata queries.
+        /// \details See simple_omero::image::load_images. Each image still
+        ///          opens its own RawPixelsStore.
+        /*!
+         * \param session pointer to curent session (Service Factory).
+         * \param image_ids Ids of the images to retrieve.
+         * \return images in the order of image_ids; ids not found are
+         *         skipped. The caller deletes them. If a RawPixelsStore
+         *         cannot be opened, every image is deleted and the
+         *         exception rethrown.
+         */
+        static std::vector<image *> load_images(
+            const omero::api::ServiceFactoryPrx &session,
+            const std::vector<int> &image_ids
+        );
         /// Constructor for reading.
         /*!
          * \param session pointer to curent session (Service Factory).
@@ -261,12 +499,45 @@ namespace omero2cv
             std::vector<int> channel_list,
             std::vector<int> plane_list
         );
-        /// Write data to server.
+        /// Allocates omero2cv::image_store object to store a strided
+        /// hypercube: the time points, channels and planes it selects,
+        /// each plane holding its subsampled rows and columns.
+        /*!
+         * \param cube region to store.
+         */
+        void allocate_pixel_store(const simple_omero::hyper_cube &cube);
+        /// \brief Reads a strided hypercube into pixel_store, allocated
+        ///        with allocate_pixel_store(cube).
+        /// \details With an XYZCT arena the pixels are converted straight
+        ///          into it.
+        /*!
+         * \param cube region to read.
+         * \return 0 sucess; -1 Failed.
+         */
+        int read_hyper_cube(const simple_omero::hyper_cube &cube);
+        /// \brief Reads a strided hypercube into a 5D Mat.
+        /*!
+         * \param cube region to read.
+         * \param destination Mat receiving the pixels, of dimensions
+         *        (t, c, z, y, x) in that order. Reused if it already has
+         *        that shape and the image's type.
+         * \return 0 sucess; -1 Failed.
+         */
+        int read_hyper_cube(
+            const simple_omero::hyper_cube &cube, cv::Mat &destination
+        );
+        /// Write data to server. Up to write_depth requests are in transit
+        /// while the next plane is converted; whole stacks and time points
+        /// are sent with a single setStack or setTimepoint when they fit
+        /// in Ice.MessageSizeMax.
         /*!
          * \param image image_store object containing data to write.
+         * \return 0 sucess; -1 Failed, including any plane failing to be
+         *         written.
          */
         int write_image(omero2cv::image_store *image);
-        /// To be implemented.
+        /// Write the planes of a channel to server. Up to write_depth
+        /// planes are in transit while the next one is converted.
         int write_channel(
             omero2cv::plane_store *stack,
             const int &timepoint,
@@ -286,11 +557,115 @@ namespace omero2cv
         //{this->omero_image->upload_and_link_file(session, path, type);};
         /// Deallocate memory.
         void clear_pixel_store();
-        ///
+        /// Sets every plane of pixel_store to zero, in place if the
+        /// planes point into an arena.
         void allocate_zero_mat();
+        /// \brief Reads a region of a single plane tile by tile.
+        /// \details Only prefetch_depth tiles are held in memory besides
+        ///          the destination, so regions of planes too large for a
+        ///          single getPlane can be read.
+        /*!
+         * \param timepoint time point to read.
+         * \param channel channel to read.
+         * \param plane z plane to read.
+         * \param region region of the plane to read, clipped to the plane.
+         * \param destination Mat receiving the region. Allocated if it does
+         *        not already have the region's size and the image's type.
+         * \return 0 sucess; -1 Failed.
+         */
+        int read_region(
+            const int &timepoint, const int &channel, const int &plane,
+            const cv::Rect &region, cv::Mat &destination
+        );
+        /// \brief Projects the z planes of a channel while they are read,
+        ///        without holding the stack.
+        /// \details Each plane is folded into the projection as soon as
+        ///          it arrives, while the next ones are still in transit,
+        ///          so memory use is one plane plus the accumulator. max
+        ///          and min keep the image's type, sum is CV_64F, mean and
+        ///          stddev are CV_32F. No pixel_store is needed.
+        /*!
+         * \param mode o2cv_projection_max, o2cv_projection_min,
+         *        o2cv_projection_mean, o2cv_projection_sum or
+         *        o2cv_projection_stddev.
+         * \param timepoint time point to project.
+         * \param channel channel to project.
+         * \param projection Mat receiving the projection.
+         * \return 0 sucess; -1 Failed.
+         */
+        int project(
+            const int &mode, const int &timepoint, const int &channel,
+            cv::Mat &projection
+        );
+        /// \brief Projects every channel of a time point, reading the
+        ///        planes of all channels through a single pipeline.
+        /*!
+         * \param mode projection mode, see project.
+         * \param timepoint time point to project.
+         * \param projections store receiving one projection per channel.
+         * \return 0 sucess; -1 Failed.
+         */
+        int project(
+            const int &mode, const int &timepoint, plane_store &projections
+        );
+        /// \brief Gets the tile size used by tile reads: tile_width and
+        ///        tile_height if set, the server's tile size otherwise,
+        ///        or strips of whole rows if the server reports none.
+        /*!
+         * \param width tile width.
+         * \param height tile height.
+         */
+        void get_tile_size(int &width, int &height);
         /// Read the data from the server. Before using this method allocate
-        /// buffer using allocate_pixel_store.
-        void read_image();
+        /// buffer using allocate_pixel_store. Up to prefetch_depth planes
+        /// are requested ahead of the one being decoded. Whole stacks and
+        /// time points are read with a single getStack or getTimepoint
+        /// when they fit in Ice.MessageSizeMax. With
+        /// number_of_readers > 1 the planes are spread over that many
+        /// RawPixelsStores, each read by its own thread. Planes found in
+        /// simple_omero::plane_cache::shared are not requested.
+        /*!
+         * \return 0 sucess; -1 Failed, the planes not read are left
+         *         unset.
+         */
+        int read_image();
+        /// \brief Reads and writes the pixels through a local source
+        ///        instead of the server's RawPixelsStore.
+        /// \details Planes are then read and written one at a time on
+        ///          the calling thread; number_of_readers is ignored.
+        /*!
+         * \param source source of the pixels, e.g. a
+         *        simple_omero::file_pixel_source. Deleted by the image.
+         * \return 0 sucess; -1 if source is NULL or not open, in which
+         *         case the caller keeps it.
+         */
+        int open_pixel_source(simple_omero::pixel_source *source);
+        /// \brief Gets the number of resolution levels of the image.
+        /*!
+         * \return number of levels; 1 if the image has no pyramid.
+         */
+        int get_resolution_levels();
+        /// \brief Sets the resolution level read_image and tile reads
+        ///        read at, for cheap previews of large images.
+        /// \details Levels go from 0, the smallest, to
+        ///          get_resolution_levels() - 1, full resolution. size_x,
+        ///          size_y and the pixel sizes are set to the level's, so
+        ///          call it before allocate_pixel_store.
+        /*!
+         * \param level resolution level.
+         * \return 0 sucess; -1 Failed.
+         */
+        int set_resolution_level(const int &level);
+        /// \brief Sets the local cache read_image looks planes up in
+        ///        before asking the server, and stores the planes it
+        ///        reads in. Planes cached before the pixels were last
+        ///        updated are dropped, as are those of the pixels the
+        ///        image writes to.
+        /*!
+         * \param cache cache to use, NULL to stop using one. Not owned;
+         *        it must outlive the image and can be shared by images.
+         */
+        void set_disk_cache(disk_cache *cache);
         /// Buffer to store the data in memory.
         image_store *pixel_store;
         /// OMERO pixel type.
@@ -299,6 +674,32 @@ namespace omero2cv
         int pixel_type_cv;
         /// Bytes per pixel.
         int pixel_type_bpp;
+        /// Number of getPlane requests kept in flight by read_image.
+        int prefetch_depth;
+        /// Number of setPlane requests kept in flight by write_image and
+        /// write_channel.
+        int write_depth;
+        /// Number of RawPixelsStores read_image spreads the planes over.
+        int number_of_readers;
+        /// Sessions the additional RawPixelsStores are opened from, used in
+        /// turn. If empty, the session the image was opened with is used.
+        std::vector<omero::api::ServiceFactoryPrx> reader_sessions;
+        /// Width of the tiles read by tile_iterator and read_region;
+        /// 0 uses the server's tile width.
+        int tile_width;
+        /// Height of the tiles read by tile_iterator and read_region;
+        /// 0 uses the server's tile height.
+        int tile_height;
+        /// If true, allocate_pixel_store backs all planes with a single
+        /// pixel_arena instead of one allocation per plane.
+        bool use_arena;
+        /// Dimension order of the pixel_arena, e.g. "XYZCT".
+        std::string arena_dimension_order;
+        /// If true, the pixel_arena is backed with huge pages where the
+        /// operating system supports it.
+        bool arena_huge_pages;
+        /// Resolution level read at; -1 for full resolution.
+        int resolution_level;
         /// List of timepoint to read.
         std::vector<int> timepoint_list;
         /// List of channels to read.
@@ -337,4 +738,102 @@ namespace omero2cv
         double min;
     };
 #endif //_omero2cv_image_included_
+
+
+#ifndef _omero2cv_tile_iterator_included_
+#define _omero2cv_tile_iterator_included_
+    /// \brief Streams the tiles covering a region of a single plane.
+    /// \details Tiles are aligned to the image's tile grid, clipped to the
+    ///          region and returned row by row. prefetch_depth getTile
+    ///          requests of the image are kept in flight.
+    class tile_iterator
+    {
+    public:
+        /// Constructor. Issues the first requests.
+        /*!
+         * \param source image to read from.
+         * \param timepoint time point to read.
+         * \param channel channel to read.
+         * \param plane z plane to read.
+         * \param region region of the plane to cover, clipped to the plane.
+         */
+        tile_iterator(
+            image &source, const int &timepoint, const int &channel,
+            const int &plane, const cv::Rect &region
+        );
+        /// Destructor.
+        ~tile_iterator();
+        /// \brief Waits for the next tile.
+        /*!
+         * \param tile Mat receiving the tile's pixels. Reused if it already
+         *        has the tile's size and type.
+         * \param roi position of the tile in the plane.
+         * \return true if a tile was returned; false if all tiles have
+         *         been read. Throws std::length_error if the server
+         *         returned fewer bytes than the tile holds.
+         */
+        bool next(cv::Mat &tile, cv::Rect &roi);
+        /// Number of tiles covering the region.
+        int number_of_tiles;
+    private:
+        /// Not copyable, it owns the requests in flight.
+        tile_iterator(const tile_iterator &);
+        tile_iterator &operator=(const tile_iterator &);
+        /// Keeps the getTile requests in flight.
+        simple_omero::tile_prefetcher *prefetcher;
+        /// OpenCV pixel type.
+        int cv_type;
+        /// Converts the pixels of the image's type.
+        simple_omero::byte_swap_kernel swap;
+    };
+#endif //_omero2cv_tile_iterator_included_
+
+#ifndef _omero2cv_plane_iterator_included_
+#define _omero2cv_plane_iterator_included_
+    /// \brief Streams the planes of an image without holding them all in
+    ///        memory.
+    /// \details Planes of the image's timepoint_list, channel_list and
+    ///          plane_list are returned in the same order as read_image
+    ///          stores them. Only prefetch_depth getPlane requests and the
+    ///          plane being returned are held in memory, so images larger
+    ///          than RAM can be processed in a single pass.
+    class plane_iterator
+    {
+    public:
+        /// Constructor. Issues the first requests.
+        /*!
+         * \param source image to read from.
+         */
+        plane_iterator(image &source);
+        /// Destructor.
+        ~plane_iterator();
+        /// \brief Waits for the next plane.
+        /*!
+         * \param plane Mat receiving the plane. It shares a buffer that is
+         *        reused by the next call; clone it to keep it.
+         * \param index position of the plane in the image.
+         * \return true if a plane was returned; false if all planes have
+         *         been read.
+         */
+        bool next(cv::Mat &plane, simple_omero::plane_index &index);
+        /// Number of planes returned by a full pass.
+        int number_of_planes;
+    private:
+        /// Not copyable, it owns the requests in flight.
+        plane_iterator(const plane_iterator &);
+        plane_iterator &operator=(const plane_iterator &);
+        /// Keeps the getPlane requests in flight.
+        simple_omero::plane_prefetcher *prefetcher;
+        /// Plane buffer handed out by next().
+        cv::Mat buffer;
+        /// Plane width.
+        int size_x;
+        /// Plane height.
+        int size_y;
+        /// OpenCV pixel type.
+        int cv_type;
+        /// Converts the pixels of the image's type.
+        simple_omero::byte_swap_kernel swap;
+    };
+#endif //_omero2cv_plane_iterator_included_
 }
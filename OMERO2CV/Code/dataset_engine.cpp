@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "dataset_engine.h"
+#include <unistd.h>
+
+
+/// Thread running work_stealing_pool::work.
+class omero2cv::work_stealing_pool::worker_thread : public IceUtil::Thread
+{
+    public:
+        worker_thread(work_stealing_pool *pool, const int &worker)
+        {
+            this->pool = pool;
+            this->worker = worker;
+        }
+        virtual void run() {this->pool->work(this->worker);}
+    private:
+        work_stealing_pool *pool;
+        int worker;
+};
+
+
+omero2cv::work_stealing_pool::work_stealing_pool(
+    const int &number_of_workers)
+{
+    this->pending = 0;
+    this->queued = 0;
+    this->steal_count = 0;
+    this->next_worker = 0;
+    this->stopping = false;
+    int workers = number_of_workers > 0 ? number_of_workers : 1;
+    for (int i = 0; i < workers; i++) {
+        this->queues.push_back(new task_queue());
+    }
+    for (int i = 0; i < workers; i++) {
+        IceUtil::ThreadPtr thread = new worker_thread(this, i);
+        this->threads.push_back(thread->start());
+    }
+}
+
+
+omero2cv::work_stealing_pool::~work_stealing_pool()
+{
+    this->wait();
+    {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        this->stopping = true;
+        this->monitor.notifyAll();
+    }
+    for (size_t i = 0; i < this->threads.size(); i++) {
+        this->threads.at(i).join();
+    }
+    for (size_t i = 0; i < this->queues.size(); i++) {
+        delete this->queues.at(i);
+    }
+}
+
+
+void omero2cv::work_stealing_pool::submit(
+    pool_task *task, const int &worker)
+{
+    int target = worker;
+    {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        if (target < 0 || target >= (int)this->queues.size()) {
+            target = this->next_worker;
+            this->next_worker = (this->next_worker + 1) % this->queues.size();
+        }
+        this->pending++;
+    }
+    {
+        IceUtil::Mutex::Lock lock(this->queues.at(target)->mutex);
+        this->queues.at(target)->tasks.push_back(task);
+    }
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    this->queued++;
+    this->monitor.notifyAll();
+}
+
+
+void omero2cv::work_stealing_pool::wait()
+{
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    while (this->pending > 0) {
+        this->monitor.wait();
+    }
+}
+
+
+long long omero2cv::work_stealing_pool::steals()
+{
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    return this->steal_count;
+}
+
+
+omero2cv::pool_task *omero2cv::work_stealing_pool::take(const int &worker)
+{
+    pool_task *task = NULL;
+    bool stolen = false;
+    {
+        // Own deque, newest first: its data is the most likely cached.
+        IceUtil::Mutex::Lock lock(this->queues.at(worker)->mutex);
+        if (!this->queues.at(worker)->tasks.empty()) {
+            task = this->queues.at(worker)->tasks.back();
+            this->queues.at(worker)->tasks.pop_back();
+        }
+    }
+    for (size_t i = 1; task == NULL && i < this->queues.size(); i++) {
+        // Other deques, oldest first, away from their owner's end.
+        task_queue *victim = this->queues.at((worker + i) % this->queues.size());
+        IceUtil::Mutex::Lock lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            stolen = true;
+        }
+    }
+    if (task != NULL) {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        this->queued--;
+        if (stolen) {
+            this->steal_count++;
+        }
+    }
+    return task;
+}
+
+
+void omero2cv::work_stealing_pool::work(const int &worker)
+{
+    while (true) {
+        pool_task *task = this->take(worker);
+        if (task == NULL) {
+            IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+            while (this->queued <= 0 && !this->stopping) {
+                this->monitor.wait();
+            }
+            if (this->queued <= 0) {
+                return;
+            }
+            continue;
+        }
+        try {
+            task->run(worker);
+        } catch (...) {
+            simpleomero_log(simpleomero_log_error, "Pool task failed!!!!");
+        }
+        delete task;
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        this->pending--;
+        if (this->pending == 0) {
+            this->monitor.notifyAll();
+        }
+    }
+}
+
+
+/// Thread running dataset_engine::fetch.
+class omero2cv::dataset_engine::fetcher_thread : public IceUtil::Thread
+{
+    public:
+        fetcher_thread(dataset_engine *engine) {this->engine = engine;}
+        virtual void run() {this->engine->fetch();}
+    private:
+        dataset_engine *engine;
+};
+
+
+/// Thread running dataset_engine::upload.
+class omero2cv::dataset_engine::uploader_thread : public IceUtil::Thread
+{
+    public:
+        uploader_thread(dataset_engine *engine) {this->engine = engine;}
+        virtual void run() {this->engine->upload();}
+    private:
+        dataset_engine *engine;
+};
+
+
+/// Applies dataset_job::process_stack to one stack of an image.
+class omero2cv::dataset_engine::stack_task : public pool_task
+{
+    public:
+        stack_task(
+            dataset_engine *engine, image_state *state,
+            const int &timepoint, const int &channel)
+        {
+            this->engine = engine;
+            this->state = state;
+            this->timepoint = timepoint;
+            this->channel = channel;
+        }
+        virtual void run(const int &worker)
+        {
+            int result = -1;
+            try {
+                result = this->engine->job->process_stack(
+                    *this->state->source, this->timepoint, this->channel,
+                    *this->state->source->pixel_store->t(this->timepoint)
+                        ->c(this->channel)
+                );
+            } catch (...) {
+                result = -1;
+            }
+            bool last;
+            {
+                IceUtil::Monitor<IceUtil::Mutex>::Lock lock(
+                    this->engine->monitor
+                );
+                if (result != 0) {
+                    this->state->failed = true;
+                }
+                this->state->remaining--;
+                last = this->state->remaining == 0;
+            }
+            if (last) {
+                this->engine->stacks_done(this->state);
+            }
+        }
+    private:
+        dataset_engine *engine;
+        image_state *state;
+        int timepoint;
+        int channel;
+};
+
+
+omero2cv::dataset_engine::dataset_engine(
+    const omero::api::ServiceFactoryPrx &session, dataset_job *job)
+{
+    this->session = session;
+    this->job = job;
+    this->pool = NULL;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    this->number_of_workers = processors > 0 ? (int)processors : 1;
+    this->number_of_fetchers = o2cv_default_number_of_fetchers;
+    this->number_of_uploaders = o2cv_default_number_of_uploaders;
+    this->memory_budget = o2cv_default_memory_budget;
+    this->output_dataset_id = -1;
+    this->output_suffix = "_processed";
+    this->next_image = 0;
+    this->finished = 0;
+    this->bytes_in_use = 0;
+}
+
+
+std::vector<int> omero2cv::dataset_engine::list_images(
+    const omero::api::ServiceFactoryPrx &session, const int &dataset_id)
+{
+    std::vector<int> image_ids;
+    try {
+        omero::api::IContainerPrx container_service =
+            session->getContainerService();
+        omero::sys::ParametersIPtr param = new omero::sys::ParametersI();
+        param->leaves();
+        omero::sys::LongList dataset_list;
+        dataset_list.push_back(dataset_id);
+        omero::api::IObjectList datasets =
+            container_service->loadContainerHierarchy(
+                "Dataset", dataset_list, param
+        );
+        std::vector<omero::model::DatasetPtr> dataset =
+            omero::cast<omero::model::DatasetPtr>(datasets);
+        for (size_t i = 0; i < dataset.size(); i++) {
+            omero::model::DatasetLinkedImageSeq image_list =
+                dataset.at(i)->linkedImageList();
+            for (size_t j = 0; j < image_list.size(); j++) {
+                image_ids.push_back(image_list.at(j)->getId()->getValue());
+            }
+        }
+    } catch (...) {
+        simpleomero_log(simpleomero_log_error,
+            "Dataset " << dataset_id << " could not be listed!!!!"
+        );
+    }
+    return image_ids;
+}
+
+
+int omero2cv::dataset_engine::run(const int &dataset_id)
+{
+    return this->run(list_images(this->session, dataset_id));
+}
+
+
+int omero2cv::dataset_engine::run(const std::vector<int> &image_ids)
+{
+    this->failed_images.clear();
+    this->handles = simple_omero::image::load_images(this->session, image_ids);
+    if (this->handles.size() != image_ids.size()) {
+        std::set<int> loaded;
+        for (size_t i = 0; i < this->handles.size(); i++) {
+            loaded.insert(this->handles.at(i)->id);
+        }
+        for (size_t i = 0; i < image_ids.size(); i++) {
+            if (loaded.count(image_ids.at(i)) == 0) {
+                this->failed_images.push_back(image_ids.at(i));
+            }
+        }
+    }
+    this->next_image = 0;
+    this->finished = 0;
+    this->bytes_in_use = 0;
+    this->pool = new work_stealing_pool(this->number_of_workers);
+
+    std::vector<IceUtil::ThreadPtr> threads;
+    std::vector<IceUtil::ThreadControl> controls;
+    int fetchers = this->number_of_fetchers > 0 ? this->number_of_fetchers : 1;
+    int uploaders =
+        this->number_of_uploaders > 0 ? this->number_of_uploaders : 1;
+    for (int i = 0; i < fetchers; i++) {
+        threads.push_back(new fetcher_thread(this));
+        controls.push_back(threads.back()->start());
+    }
+    for (int i = 0; i < uploaders; i++) {
+        threads.push_back(new uploader_thread(this));
+        controls.push_back(threads.back()->start());
+    }
+    for (size_t i = 0; i < controls.size(); i++) {
+        controls.at(i).join();
+    }
+    delete this->pool;
+    this->pool = NULL;
+    this->handles.clear();
+    return this->failed_images.empty() ? 0 : -1;
+}
+
+
+void omero2cv::dataset_engine::fetch()
+{
+    pixel_type_registry *registry = pixel_type_registry::get(this->session);
+    while (true) {
+        simple_omero::image *handle;
+        image_state *state = new image_state();
+        {
+            IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+            if (this->next_image >= this->handles.size()) {
+                delete state;
+                return;
+            }
+            handle = this->handles.at(this->next_image);
+            this->next_image++;
+            int type = registry->index_of(handle->pixel_type);
+            long long bpp = type < 0 ? 8 : pixel_type_registry::bpp[type];
+            state->bytes = (long long)handle->size_x * handle->size_y
+                * handle->size_z * handle->number_of_channels
+                * handle->number_of_timepoints * bpp;
+            // An image larger than the budget waits until it is alone.
+            while (this->bytes_in_use > 0 &&
+                   this->bytes_in_use + state->bytes > this->memory_budget) {
+                this->monitor.wait();
+            }
+            this->bytes_in_use += state->bytes;
+        }
+        state->image_id = handle->id;
+        state->source = NULL;
+        state->failed = false;
+        state->remaining = 0;
+        try {
+            state->source = new image(this->session, handle);
+            state->source->allocate_pixel_store();
+            // Partly read images must not be processed and uploaded.
+            if (state->source->read_image() != 0) {
+                throw std::runtime_error("Image not read");
+            }
+        } catch (...) {
+            simpleomero_log(simpleomero_log_error,
+                "Image " << state->image_id << " could not be read!!!!"
+            );
+            if (state->source == NULL) {
+                delete handle;
+            }
+            state->failed = true;
+            this->finish(state);
+            continue;
+        }
+        // Count every stack before queuing any, so the last one to
+        // finish is known.
+        image_store *pixels = state->source->pixel_store;
+        for (size_t t = 0; t < pixels->size(); t++) {
+            state->remaining += pixels->t(t)->size();
+        }
+        if (state->remaining == 0) {
+            this->stacks_done(state);
+            continue;
+        }
+        for (size_t t = 0; t < pixels->size(); t++) {
+            for (size_t c = 0; c < pixels->t(t)->size(); c++) {
+                this->pool->submit(new stack_task(this, state, t, c));
+            }
+        }
+    }
+}
+
+
+void omero2cv::dataset_engine::stacks_done(image_state *state)
+{
+    if (!state->failed) {
+        try {
+            if (this->job->process_image(
+                    *state->source, *state->source->pixel_store) != 0) {
+                state->failed = true;
+            }
+        } catch (...) {
+            state->failed = true;
+        }
+    }
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    this->uploads.push_back(state);
+    this->monitor.notifyAll();
+}
+
+
+void omero2cv::dataset_engine::upload()
+{
+    while (true) {
+        image_state *state;
+        {
+            IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+            while (this->uploads.empty() &&
+                   this->finished < this->handles.size()) {
+                this->monitor.wait();
+            }
+            if (this->uploads.empty()) {
+                return;
+            }
+            state = this->uploads.front();
+            this->uploads.pop_front();
+        }
+        if (!state->failed && this->output_dataset_id >= 0) {
+            if (this->write(*state->source) != 0) {
+                state->failed = true;
+            }
+        }
+        this->finish(state);
+    }
+}
+
+
+int omero2cv::dataset_engine::write(image &source)
+{
+    try {
+        image output(
+            this->session, this->output_dataset_id, source.pixel_type_omero,
+            source.size_x, source.size_y, source.size_z,
+            source.number_of_channels, source.number_of_timepoints,
+            source.name + this->output_suffix, source.description,
+            source.pixel_size_x, source.pixel_size_y, source.pixel_size_z
+        );
+        return output.write_image(source.pixel_store);
+    } catch (...) {
+        simpleomero_log(simpleomero_log_error,
+            "Image " << source.id << " could not be written!!!!"
+        );
+        return -1;
+    }
+}
+
+
+void omero2cv::dataset_engine::finish(image_state *state)
+{
+    delete state->source;
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    if (state->failed) {
+        this->failed_images.push_back(state->image_id);
+    }
+    this->bytes_in_use -= state->bytes;
+    this->finished++;
+    this->monitor.notifyAll();
+    delete state;
+}
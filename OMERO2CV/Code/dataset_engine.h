@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <deque>
+#include <set>
+#include <vector>
+#include <string>
+#include "OMERO2CV.h"
+#include <IceUtil/Thread.h>
+#include <IceUtil/Monitor.h>
+#include <IceUtil/Mutex.h>
+
+
+/// Default number of images read from the server at once.
+#define o2cv_default_number_of_fetchers 2
+/// Default number of images written to the server at once.
+#define o2cv_default_number_of_uploaders 2
+/// Default memory budget of a dataset_engine: 4 GB.
+#define o2cv_default_memory_budget (4LL << 30)
+
+
+namespace omero2cv
+{
+#ifndef _omero2cv_dataset_engine_included_
+#define _omero2cv_dataset_engine_included_
+    /// \brief User function a dataset_engine applies to every image.
+    /// \details Both methods are called concurrently, for different
+    ///          stacks and images, and must not share unguarded state.
+    class dataset_job
+    {
+    public:
+        virtual ~dataset_job() {};
+        /// \brief Processes the z stack of one channel at one time point,
+        ///        in place. The stacks of an image run in parallel.
+        /*!
+         * \param source image the stack belongs to.
+         * \param timepoint time point of the stack.
+         * \param channel channel of the stack.
+         * \param stack planes to process.
+         * \return 0 sucess; -1 Failed, the image is not uploaded.
+         */
+        virtual int process_stack(
+            image &source, const int &timepoint, const int &channel,
+            plane_store &stack
+        ) {return 0;};
+        /// \brief Processes a whole image, once all its stacks are
+        ///        processed and before it is uploaded.
+        /*!
+         * \param source image being processed.
+         * \param pixels its pixels.
+         * \return 0 sucess; -1 Failed, the image is not uploaded.
+         */
+        virtual int process_image(image &source, image_store &pixels)
+        {return 0;};
+    };
+
+    /// \brief Unit of work run by a work_stealing_pool.
+    class pool_task
+    {
+    public:
+        virtual ~pool_task() {};
+        /// Runs the task. It is deleted afterwards.
+        /*!
+         * \param worker index of the worker running it, to submit
+         *        follow-up tasks to.
+         */
+        virtual void run(const int &worker) = 0;
+    };
+
+    /// \brief Fixed set of threads, each with its own task deque.
+    /// \details A worker runs its own newest task first and, when its
+    ///          deque is empty, steals the oldest task of another worker,
+    ///          so uneven work spreads itself over the threads.
+    class work_stealing_pool
+    {
+    public:
+        /// Constructor. Starts the threads.
+        /*!
+         * \param number_of_workers number of threads.
+         */
+        work_stealing_pool(const int &number_of_workers);
+        /// Destructor. Runs the remaining tasks and joins the threads.
+        ~work_stealing_pool();
+        /// \brief Queues a task, taking ownership of it.
+        /*!
+         * \param task task to run.
+         * \param worker worker to queue it to; -1 spreads the tasks
+         *        round robin.
+         */
+        void submit(pool_task *task, const int &worker = -1);
+        /// Waits until every queued task has run.
+        void wait();
+        /// Number of threads.
+        int size() {return this->queues.size();};
+        /// Number of tasks run by a worker other than the one queued to.
+        long long steals();
+    private:
+        class worker_thread;
+        friend class worker_thread;
+        /// Task deque of a worker.
+        struct task_queue {
+            std::deque<pool_task *> tasks;
+            IceUtil::Mutex mutex;
+        };
+        /// Takes a task for worker, stealing if its deque is empty.
+        /// Returns NULL if there are none.
+        pool_task *take(const int &worker);
+        /// Body of the worker threads.
+        void work(const int &worker);
+        std::vector<task_queue *> queues;
+        std::vector<IceUtil::ThreadControl> threads;
+        /// Tasks queued and not yet finished.
+        long long pending;
+        /// Tasks queued and not yet taken.
+        long long queued;
+        long long steal_count;
+        /// Next worker for round robin submissions.
+        int next_worker;
+        bool stopping;
+        /// Guards the counters above; idle workers and wait() sleep on it.
+        IceUtil::Monitor<IceUtil::Mutex> monitor;
+    };
+
+    /// \brief Applies a dataset_job to every image of a dataset.
+    /// \details Images are read by number_of_fetchers threads, their
+    ///          stacks processed on a work_stealing_pool and the results
+    ///          written by number_of_uploaders threads, so reading,
+    ///          computing and writing of different images overlap. An
+    ///          image is only read once its pixel store fits in
+    ///          memory_budget next to the images already in flight; an
+    ///          image larger than the budget is processed on its own.
+    class dataset_engine
+    {
+    public:
+        /// Constructor.
+        /*!
+         * \param session pointer to curent session (Service Factory).
+         * \param job function to apply. Not owned.
+         */
+        dataset_engine(
+            const omero::api::ServiceFactoryPrx &session, dataset_job *job
+        );
+        /// \brief Lists the images of a dataset.
+        /*!
+         * \param session pointer to curent session (Service Factory).
+         * \param dataset_id dataset to list.
+         * \return image ids; empty if the dataset is not found.
+         */
+        static std::vector<int> list_images(
+            const omero::api::ServiceFactoryPrx &session,
+            const int &dataset_id
+        );
+        /// \brief Processes every image of a dataset.
+        /*!
+         * \param dataset_id dataset to process.
+         * \return 0 sucess; -1 Failed, the failing images are listed in
+         *         failed_images.
+         */
+        int run(const int &dataset_id);
+        /// \brief Processes a list of images.
+        /*!
+         * \param image_ids images to process.
+         * \return 0 sucess; -1 Failed, the failing images are listed in
+         *         failed_images.
+         */
+        int run(const std::vector<int> &image_ids);
+        /// Number of threads processing stacks; defaults to the number of
+        /// processors.
+        int number_of_workers;
+        /// Number of images read at once.
+        int number_of_fetchers;
+        /// Number of images written at once.
+        int number_of_uploaders;
+        /// Maximum bytes of pixel stores held at once.
+        long long memory_budget;
+        /// Dataset processed images are written to as new images; -1 to
+        /// not write them.
+        int output_dataset_id;
+        /// Appended to the name of the source image to name the new one.
+        std::string output_suffix;
+        /// Images whose reading, processing or writing failed in the last
+        /// run.
+        std::vector<int> failed_images;
+    private:
+        class fetcher_thread;
+        class uploader_thread;
+        class stack_task;
+        friend class fetcher_thread;
+        friend class uploader_thread;
+        friend class stack_task;
+        /// An image between reading and writing.
+        struct image_state {
+            int image_id;
+            /// NULL if the image could not be opened.
+            image *source;
+            long long bytes;
+            /// Stacks not yet processed.
+            int remaining;
+            bool failed;
+        };
+        /// Body of the fetcher threads.
+        void fetch();
+        /// Body of the uploader threads.
+        void upload();
+        /// Called by the stack task finishing the last stack of an image.
+        void stacks_done(image_state *state);
+        /// Writes an image to output_dataset_id. Returns 0 sucess; -1
+        /// Failed.
+        int write(image &source);
+        /// Counts an image as done, releasing its share of the budget.
+        void finish(image_state *state);
+        omero::api::ServiceFactoryPrx session;
+        dataset_job *job;
+        work_stealing_pool *pool;
+        /// Images of the current run, retrieved in bulk.
+        std::vector<simple_omero::image *> handles;
+        /// Next handle to fetch.
+        size_t next_image;
+        /// Images done, failed or not.
+        size_t finished;
+        /// Bytes of pixel stores held.
+        long long bytes_in_use;
+        /// Images waiting for upload.
+        std::deque<image_state *> uploads;
+        /// Guards every member above and failed_images.
+        IceUtil::Monitor<IceUtil::Mutex> monitor;
+    };
+#endif //_omero2cv_dataset_engine_included_
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "disk_cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+
+namespace
+{
+    /// Creates path and its missing parents.
+    void make_directories(const std::string &path)
+    {
+        for (size_t i = 1; i <= path.size(); i++) {
+            if (i == path.size() || path[i] == '/') {
+                mkdir(path.substr(0, i).c_str(), 0755);
+            }
+        }
+    }
+
+    /// Lists the entries of a directory, without "." and "..".
+    std::vector<std::string> list_directory(const std::string &path)
+    {
+        std::vector<std::string> names;
+        DIR *directory = opendir(path.c_str());
+        if (directory == NULL) {
+            return names;
+        }
+        struct dirent *item;
+        while ((item = readdir(directory)) != NULL) {
+            std::string name = item->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        closedir(directory);
+        return names;
+    }
+
+    /// A plane file found in the cache directory.
+    struct found_file {
+        std::string path;
+        long long size;
+        /// Last modification, i.e. last read or write.
+        time_t modified;
+        bool operator<(const found_file &other) const
+        {
+            return this->modified < other.modified;
+        }
+    };
+
+    /// True if name is a <plane>.<pid>.<thread>.tmp file written by
+    /// disk_cache::write.
+    bool is_temporary(const std::string &name)
+    {
+        const std::string suffix = ".tmp";
+        return name.size() > suffix.size() &&
+            name.compare(name.size() - suffix.size(), suffix.size(),
+                         suffix) == 0;
+    }
+
+    /// True if the process that wrote a temporary file has exited, so the
+    /// file will never be renamed into place.
+    bool is_abandoned(const std::string &name)
+    {
+        // Drop ".tmp" and the thread, leaving the pid last.
+        std::string rest = name.substr(0, name.size() - 4);
+        rest = rest.substr(0, rest.rfind('.'));
+        size_t dot = rest.rfind('.');
+        if (dot == std::string::npos) {
+            return true;
+        }
+        pid_t pid = atol(rest.c_str() + dot + 1);
+        return pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH);
+    }
+}
+
+
+omero2cv::disk_cache::disk_cache(
+    const std::string &directory, const long long &size_limit)
+{
+    this->directory = directory;
+    this->size_limit = size_limit;
+    this->current_size = 0;
+    this->hit_count = 0;
+    this->miss_count = 0;
+    this->eviction_count = 0;
+    make_directories(this->directory);
+    // Index the planes left by previous runs, oldest first.
+    std::vector<found_file> found;
+    std::vector<std::string> pixels = list_directory(this->directory);
+    for (size_t p = 0; p < pixels.size(); p++) {
+        std::string pixels_path = this->directory + "/" + pixels.at(p);
+        std::vector<std::string> events = list_directory(pixels_path);
+        for (size_t e = 0; e < events.size(); e++) {
+            std::string event_path = pixels_path + "/" + events.at(e);
+            std::vector<std::string> planes = list_directory(event_path);
+            for (size_t i = 0; i < planes.size(); i++) {
+                std::string path = event_path + "/" + planes.at(i);
+                if (is_temporary(planes.at(i))) {
+                    // Partial planes of crashed writers are not cached.
+                    if (is_abandoned(planes.at(i))) {
+                        unlink(path.c_str());
+                    }
+                    continue;
+                }
+                struct stat status;
+                if (stat(path.c_str(), &status) == 0 &&
+                    S_ISREG(status.st_mode)) {
+                    found_file file;
+                    file.path = path;
+                    file.size = status.st_size;
+                    file.modified = status.st_mtime;
+                    found.push_back(file);
+                }
+            }
+        }
+    }
+    std::stable_sort(found.begin(), found.end());
+    IceUtil::Mutex::Lock lock(this->mutex);
+    for (size_t i = 0; i < found.size(); i++) {
+        this->insert(found.at(i).path, found.at(i).size);
+    }
+    this->evict();
+}
+
+
+std::string omero2cv::disk_cache::event_directory(
+    const long long &pixels_id, const long long &update_event)
+{
+    std::ostringstream path;
+    path << this->directory << "/" << pixels_id << "/" << update_event;
+    return path.str();
+}
+
+
+std::string omero2cv::disk_cache::plane_path(
+    const long long &pixels_id, const long long &update_event,
+    const int &resolution_level, const simple_omero::plane_index &index)
+{
+    std::ostringstream path;
+    path << this->event_directory(pixels_id, update_event) << "/"
+         << index.time_point << "_" << index.channel << "_" << index.plane;
+    if (resolution_level >= 0) {
+        path << "." << resolution_level;
+    }
+    path << ".plane";
+    return path.str();
+}
+
+
+void omero2cv::disk_cache::open(
+    const long long &pixels_id, const long long &update_event)
+{
+    std::ostringstream pixels_path;
+    pixels_path << this->directory << "/" << pixels_id;
+    std::ostringstream current;
+    current << update_event;
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::vector<std::string> events = list_directory(pixels_path.str());
+    for (size_t e = 0; e < events.size(); e++) {
+        if (events.at(e) != current.str()) {
+            this->remove_directory(pixels_path.str() + "/" + events.at(e));
+        }
+    }
+    make_directories(this->event_directory(pixels_id, update_event));
+}
+
+
+bool omero2cv::disk_cache::read(
+    const long long &pixels_id, const long long &update_event,
+    const int &resolution_level, const simple_omero::plane_index &index,
+    cv::Mat &destination)
+{
+    std::string path = this->plane_path(
+        pixels_id, update_event, resolution_level, index
+    );
+    size_t size = destination.total() * destination.elemSize();
+    bool hit = false;
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file >= 0) {
+        struct stat status;
+        if (fstat(file, &status) == 0 && status.st_size == (off_t) size &&
+            destination.isContinuous()) {
+            void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+            if (mapping != MAP_FAILED) {
+                memcpy(destination.data, mapping, size);
+                munmap(mapping, size);
+                hit = true;
+            }
+        }
+        close(file);
+    }
+    IceUtil::Mutex::Lock lock(this->mutex);
+    if (!hit) {
+        this->miss_count++;
+        return false;
+    }
+    this->hit_count++;
+    // Record the access for this and other processes sharing the cache.
+    utimes(path.c_str(), NULL);
+    std::map<std::string, std::list<entry>::iterator>::iterator item =
+        this->lookup.find(path);
+    if (item != this->lookup.end()) {
+        // Move to the front without copying the entry.
+        this->files.splice(this->files.begin(), this->files, item->second);
+    }
+    return true;
+}
+
+
+void omero2cv::disk_cache::write(
+    const long long &pixels_id, const long long &update_event,
+    const int &resolution_level, const simple_omero::plane_index &index,
+    const cv::Mat &source)
+{
+    if (!source.isContinuous()) {
+        return;
+    }
+    long long size = source.total() * source.elemSize();
+    if (size > this->size_limit) {
+        return;
+    }
+    std::string path = this->plane_path(
+        pixels_id, update_event, resolution_level, index
+    );
+    // Write to a private file first so readers never map a partial plane.
+    std::ostringstream temporary;
+    temporary << path << "." << getpid() << "." << pthread_self() << ".tmp";
+    int file = ::open(
+        temporary.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644
+    );
+    if (file < 0) {
+        return;
+    }
+    const unsigned char *data = source.data;
+    long long written = 0;
+    while (written < size) {
+        ssize_t count = ::write(file, data + written, size - written);
+        if (count <= 0) {
+            break;
+        }
+        written += count;
+    }
+    close(file);
+    if (written != size || rename(temporary.str().c_str(), path.c_str())) {
+        unlink(temporary.str().c_str());
+        return;
+    }
+    IceUtil::Mutex::Lock lock(this->mutex);
+    this->insert(path, size);
+    this->evict();
+}
+
+
+void omero2cv::disk_cache::invalidate(const long long &pixels_id)
+{
+    std::ostringstream pixels_path;
+    pixels_path << this->directory << "/" << pixels_id;
+    IceUtil::Mutex::Lock lock(this->mutex);
+    this->remove_directory(pixels_path.str());
+}
+
+
+void omero2cv::disk_cache::remove_directory(const std::string &path)
+{
+    std::vector<std::string> names = list_directory(path);
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string child = path + "/" + names.at(i);
+        struct stat status;
+        if (lstat(child.c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+            this->remove_directory(child);
+            continue;
+        }
+        unlink(child.c_str());
+        std::map<std::string, std::list<entry>::iterator>::iterator item =
+            this->lookup.find(child);
+        if (item != this->lookup.end()) {
+            this->erase(item->second);
+        }
+    }
+    rmdir(path.c_str());
+}
+
+
+void omero2cv::disk_cache::insert(
+    const std::string &path, const long long &size)
+{
+    std::map<std::string, std::list<entry>::iterator>::iterator item =
+        this->lookup.find(path);
+    if (item != this->lookup.end()) {
+        this->erase(item->second);
+    }
+    entry stored;
+    stored.path = path;
+    stored.size = size;
+    this->files.push_front(stored);
+    this->lookup[path] = this->files.begin();
+    this->current_size += size;
+}
+
+
+void omero2cv::disk_cache::erase(std::list<entry>::iterator position)
+{
+    this->current_size -= position->size;
+    this->lookup.erase(position->path);
+    this->files.erase(position);
+}
+
+
+void omero2cv::disk_cache::evict()
+{
+    while (this->current_size > this->size_limit && !this->files.empty()) {
+        std::list<entry>::iterator oldest = --this->files.end();
+        unlink(oldest->path.c_str());
+        this->erase(oldest);
+        this->eviction_count++;
+    }
+}
+
+
+long long omero2cv::disk_cache::hits()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->hit_count;
+}
+
+
+long long omero2cv::disk_cache::misses()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->miss_count;
+}
+
+
+long long omero2cv::disk_cache::evictions()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->eviction_count;
+}
+
+
+long long omero2cv::disk_cache::size()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->current_size;
+}
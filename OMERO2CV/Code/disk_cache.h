@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <list>
+#include <map>
+#include <string>
+#include <SimpleOMERO.h>
+#include <IceUtil/Mutex.h>
+#include <opencv2/core/core.hpp>
+
+
+namespace omero2cv
+{
+#ifndef _omero2cv_disk_cache_included_
+#define _omero2cv_disk_cache_included_
+    /// \brief Persistent on-disk cache of decoded planes.
+    /// \details Planes are stored native-endian, one file per plane, under
+    ///          directory/<pixels id>/<update event>/<t>_<c>_<z>.plane
+    ///          (<t>_<c>_<z>.<level>.plane below full resolution) and
+    ///          read back through mmap, so a hit is a page cache read with
+    ///          no decode. Planes of a pixels id stored under another
+    ///          update event are dropped by open(). Once the files exceed
+    ///          the size limit the least recently used ones are evicted.
+    ///          Several processes may share a directory.
+    class disk_cache
+    {
+    public:
+        /// \brief Constructor. Indexes the planes already in the
+        ///        directory and removes files left by writers that died.
+        /*!
+         * \param directory directory holding the cache, created if needed.
+         * \param size_limit maximum size of the cache in bytes.
+         */
+        disk_cache(const std::string &directory, const long long &size_limit);
+        /// \brief Prepares the cache for an image, dropping its planes
+        ///        cached under any other update event.
+        /*!
+         * \param pixels_id OMERO pixels ID.
+         * \param update_event ID of the event that last updated the pixels.
+         */
+        void open(const long long &pixels_id, const long long &update_event);
+        /// \brief Reads a plane from the cache.
+        /*!
+         * \param pixels_id OMERO pixels ID.
+         * \param update_event ID of the event that last updated the pixels.
+         * \param resolution_level resolution level; -1 for full resolution.
+         * \param index position of the plane.
+         * \param destination allocated plane receiving the pixels.
+         * \return true on a hit; false if the plane is not cached.
+         */
+        bool read(
+            const long long &pixels_id, const long long &update_event,
+            const int &resolution_level,
+            const simple_omero::plane_index &index, cv::Mat &destination
+        );
+        /// \brief Stores a plane, evicting old planes if needed.
+        /*!
+         * \param pixels_id OMERO pixels ID.
+         * \param update_event ID of the event that last updated the pixels.
+         * \param resolution_level resolution level; -1 for full resolution.
+         * \param index position of the plane.
+         * \param source continuous plane to store.
+         */
+        void write(
+            const long long &pixels_id, const long long &update_event,
+            const int &resolution_level,
+            const simple_omero::plane_index &index, const cv::Mat &source
+        );
+        /// Removes every cached plane of a pixels id.
+        void invalidate(const long long &pixels_id);
+        /// Number of reads served from the cache.
+        long long hits();
+        /// Number of reads not found in the cache.
+        long long misses();
+        /// Number of planes evicted to stay under the size limit.
+        long long evictions();
+        /// Current size of the cache in bytes.
+        long long size();
+    private:
+        /// A cached plane file.
+        struct entry {
+            /// File path.
+            std::string path;
+            /// File size in bytes.
+            long long size;
+        };
+        /// Directory of the planes of one pixels id and update event.
+        std::string event_directory(
+            const long long &pixels_id, const long long &update_event
+        );
+        /// File of one plane.
+        std::string plane_path(
+            const long long &pixels_id, const long long &update_event,
+            const int &resolution_level,
+            const simple_omero::plane_index &index
+        );
+        /// Removes the files under path from the disk and the index.
+        void remove_directory(const std::string &path);
+        /// Adds a file as the most recently used, replacing its entry if
+        /// it is indexed. Call with mutex held.
+        void insert(const std::string &path, const long long &size);
+        /// Removes an entry from the index. Call with mutex held.
+        void erase(std::list<entry>::iterator position);
+        /// Evicts least recently used planes until under the size limit.
+        void evict();
+        /// Cache directory.
+        std::string directory;
+        /// Maximum size of the cache in bytes.
+        long long size_limit;
+        /// Current size of the cache in bytes.
+        long long current_size;
+        /// Cached plane files, most recently used first.
+        std::list<entry> files;
+        /// Position of each file in files, by path.
+        std::map<std::string, std::list<entry>::iterator> lookup;
+        /// Read and eviction counters.
+        long long hit_count;
+        long long miss_count;
+        long long eviction_count;
+        /// Guards the index and the counters.
+        IceUtil::Mutex mutex;
+    };
+#endif //_omero2cv_disk_cache_included_
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "memory_cache.h"
+#include <string.h>
+
+
+omero2cv::memory_cache::memory_cache(const long long &budget)
+{
+    this->byte_budget = budget;
+    this->bytes = 0;
+    this->hit_count = 0;
+    this->miss_count = 0;
+}
+
+
+bool omero2cv::memory_cache::key::operator<(const key &other) const
+{
+    if (this->pixels_id != other.pixels_id) {
+        return this->pixels_id < other.pixels_id;
+    }
+    if (this->resolution_level != other.resolution_level) {
+        return this->resolution_level < other.resolution_level;
+    }
+    if (this->time_point != other.time_point) {
+        return this->time_point < other.time_point;
+    }
+    if (this->channel != other.channel) {
+        return this->channel < other.channel;
+    }
+    return this->plane < other.plane;
+}
+
+
+omero2cv::memory_cache::key omero2cv::memory_cache::make_key(
+    const long long &pixels_id, const int &resolution_level,
+    const simple_omero::plane_index &index)
+{
+    key id;
+    id.pixels_id = pixels_id;
+    id.resolution_level = resolution_level;
+    id.time_point = index.time_point;
+    id.channel = index.channel;
+    id.plane = index.plane;
+    return id;
+}
+
+
+bool omero2cv::memory_cache::find(const key &id, cv::Mat &plane)
+{
+    std::map<key, std::list<entry>::iterator>::iterator item =
+        this->lookup.find(id);
+    if (item == this->lookup.end()) {
+        this->miss_count++;
+        return false;
+    }
+    this->hit_count++;
+    // Move to the front without copying the entry.
+    this->planes.splice(this->planes.begin(), this->planes, item->second);
+    plane = item->second->plane;
+    return true;
+}
+
+
+bool omero2cv::memory_cache::get(
+    const long long &pixels_id, const int &resolution_level,
+    const simple_omero::plane_index &index, cv::Mat &plane)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->find(make_key(pixels_id, resolution_level, index), plane);
+}
+
+
+bool omero2cv::memory_cache::fetch(
+    const long long &pixels_id, const int &resolution_level,
+    const simple_omero::plane_index &index, unsigned char *destination,
+    const int &width, const int &height, const int &bpp)
+{
+    cv::Mat plane;
+    {
+        IceUtil::Mutex::Lock lock(this->mutex);
+        if (!this->find(
+                make_key(pixels_id, resolution_level, index), plane)) {
+            return false;
+        }
+    }
+    // The reference taken above keeps the plane alive if it is evicted
+    // while being copied.
+    if (plane.rows != height || plane.cols != width ||
+        (int) plane.elemSize() != bpp) {
+        return false;
+    }
+    memcpy(destination, plane.data, (size_t) width * height * bpp);
+    return true;
+}
+
+
+void omero2cv::memory_cache::store(
+    const long long &pixels_id, const int &resolution_level,
+    const simple_omero::plane_index &index, const unsigned char *source,
+    const int &width, const int &height, const int &bpp)
+{
+    long long size = (long long) width * height * bpp;
+    if (size > this->byte_budget) {
+        return;
+    }
+    // Copy outside the lock.
+    entry stored;
+    stored.id = make_key(pixels_id, resolution_level, index);
+    stored.plane.create(height, width, CV_8UC(bpp));
+    memcpy(stored.plane.data, source, size);
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::map<key, std::list<entry>::iterator>::iterator item =
+        this->lookup.find(stored.id);
+    if (item != this->lookup.end()) {
+        this->erase(item->second);
+    }
+    this->planes.push_front(stored);
+    this->lookup[stored.id] = this->planes.begin();
+    this->bytes += size;
+    while (this->bytes > this->byte_budget) {
+        this->erase(--this->planes.end());
+    }
+}
+
+
+void omero2cv::memory_cache::erase(std::list<entry>::iterator position)
+{
+    this->bytes -= position->plane.total() * position->plane.elemSize();
+    this->lookup.erase(position->id);
+    this->planes.erase(position);
+}
+
+
+void omero2cv::memory_cache::invalidate(const long long &pixels_id)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::list<entry>::iterator item = this->planes.begin();
+    while (item != this->planes.end()) {
+        std::list<entry>::iterator current = item++;
+        if (current->id.pixels_id == pixels_id) {
+            this->erase(current);
+        }
+    }
+}
+
+
+void omero2cv::memory_cache::clear()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    this->planes.clear();
+    this->lookup.clear();
+    this->bytes = 0;
+}
+
+
+long long omero2cv::memory_cache::hits()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->hit_count;
+}
+
+
+long long omero2cv::memory_cache::misses()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->miss_count;
+}
+
+
+double omero2cv::memory_cache::hit_rate()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    long long lookups = this->hit_count + this->miss_count;
+    if (lookups == 0) {
+        return 0;
+    }
+    return (double) this->hit_count / lookups;
+}
+
+
+long long omero2cv::memory_cache::resident_bytes()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->bytes;
+}
+
+
+size_t omero2cv::memory_cache::size()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->planes.size();
+}
+
+
+long long omero2cv::memory_cache::budget()
+{
+    return this->byte_budget;
+}
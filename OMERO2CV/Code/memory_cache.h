@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <list>
+#include <map>
+#include <SimpleOMERO.h>
+#include <IceUtil/Mutex.h>
+#include <opencv2/core/core.hpp>
+
+
+namespace omero2cv
+{
+#ifndef _omero2cv_memory_cache_included_
+#define _omero2cv_memory_cache_included_
+    /// \brief Thread safe in-memory LRU cache of decoded planes, bounded
+    ///        by a byte budget.
+    /// \details Install it as simple_omero::plane_cache::shared to share
+    ///          planes between every simple_omero::image and
+    ///          omero2cv::image of the process. Planes are held in
+    ///          reference counted Mats: evicting a plane only drops the
+    ///          cache's reference, so a Mat returned by get() stays valid.
+    class memory_cache : public simple_omero::plane_cache
+    {
+    public:
+        /// Constructor.
+        /*!
+         * \param budget maximum number of bytes of planes held.
+         */
+        memory_cache(const long long &budget);
+        /// \brief Gets a cached plane without copying it.
+        /*!
+         * \param pixels_id OMERO pixels ID.
+         * \param resolution_level resolution level; -1 for full resolution.
+         * \param index position of the plane.
+         * \param plane receives the cached plane, height x width of type
+         *        CV_8UC(bytes per pixel). Shared with the cache: do not
+         *        modify it.
+         * \return true on a hit; false if the plane is not cached.
+         */
+        bool get(
+            const long long &pixels_id, const int &resolution_level,
+            const simple_omero::plane_index &index, cv::Mat &plane
+        );
+        virtual bool fetch(
+            const long long &pixels_id, const int &resolution_level,
+            const simple_omero::plane_index &index,
+            unsigned char *destination, const int &width,
+            const int &height, const int &bpp
+        );
+        virtual void store(
+            const long long &pixels_id, const int &resolution_level,
+            const simple_omero::plane_index &index,
+            const unsigned char *source, const int &width,
+            const int &height, const int &bpp
+        );
+        virtual void invalidate(const long long &pixels_id);
+        /// Drops every plane.
+        void clear();
+        /// Number of lookups that found their plane.
+        long long hits();
+        /// Number of lookups that did not find their plane.
+        long long misses();
+        /// hits / (hits + misses); 0 before the first lookup.
+        double hit_rate();
+        /// Bytes of planes currently held.
+        long long resident_bytes();
+        /// Number of planes currently held.
+        size_t size();
+        /// Maximum number of bytes of planes held.
+        long long budget();
+    private:
+        /// Identifies a plane.
+        struct key {
+            long long pixels_id;
+            int resolution_level;
+            int time_point;
+            int channel;
+            int plane;
+            bool operator<(const key &other) const;
+        };
+        /// A cached plane.
+        struct entry {
+            key id;
+            cv::Mat plane;
+        };
+        static key make_key(
+            const long long &pixels_id, const int &resolution_level,
+            const simple_omero::plane_index &index
+        );
+        /// Looks a plane up and marks it most recently used. Call with
+        /// mutex held.
+        bool find(const key &id, cv::Mat &plane);
+        /// Removes an entry. Call with mutex held.
+        void erase(std::list<entry>::iterator position);
+        /// Maximum number of bytes of planes held.
+        long long byte_budget;
+        /// Bytes of planes currently held.
+        long long bytes;
+        long long hit_count;
+        long long miss_count;
+        /// Planes, most recently used first.
+        std::list<entry> planes;
+        /// Position of each plane in planes.
+        std::map<key, std::list<entry>::iterator> lookup;
+        /// Guards every member above.
+        IceUtil::Mutex mutex;
+    };
+#endif //_omero2cv_memory_cache_included_
+}
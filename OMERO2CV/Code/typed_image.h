@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdexcept>
+#include "OMERO2CV.h"
+
+
+namespace omero2cv
+{
+#ifndef _omero2cv_typed_image_included_
+#define _omero2cv_typed_image_included_
+    /// \brief Compile-time description of a pixel type.
+    /// \details Specialized for every type OpenCV and OMERO share.
+    template <typename T>
+    struct pixel_traits;
+
+    template <>
+    struct pixel_traits<signed char> {
+        static const int cv_type = CV_8S;
+    };
+
+    template <>
+    struct pixel_traits<unsigned char> {
+        static const int cv_type = CV_8U;
+    };
+
+    template <>
+    struct pixel_traits<short> {
+        static const int cv_type = CV_16S;
+    };
+
+    template <>
+    struct pixel_traits<unsigned short> {
+        static const int cv_type = CV_16U;
+    };
+
+    template <>
+    struct pixel_traits<int> {
+        static const int cv_type = CV_32S;
+    };
+
+    template <>
+    struct pixel_traits<float> {
+        static const int cv_type = CV_32F;
+    };
+
+    template <>
+    struct pixel_traits<double> {
+        static const int cv_type = CV_64F;
+    };
+
+    /// \brief Typed front end of an omero2cv::image of pixel type T.
+    /// \details Planes are exposed as cv::Mat_<T> views, with no copy.
+    template <typename T>
+    class typed_image
+    {
+    public:
+        /// Constructor.
+        /*!
+         * \param source image to access. Not owned.
+         */
+        typed_image(image &source) : source(source) {}
+        /// True if the image's pixel type is T.
+        bool valid() const
+        {
+            return this->source.pixel_type_cv == pixel_traits<T>::cv_type;
+        }
+        /// \brief Gets a plane of source.pixel_store.
+        /*!
+         * \param timepoint time point index in pixel_store.
+         * \param channel channel index in pixel_store.
+         * \param z plane index in pixel_store.
+         * \return view of the plane; modifying it modifies pixel_store.
+         */
+        cv::Mat_<T> plane(const int &timepoint, const int &channel,
+                          const int &z)
+        {
+            return cv::Mat_<T>(
+                this->source.pixel_store->t(timepoint)->c(channel)->z(z)
+            );
+        }
+        /// \brief Reads a region of a single plane tile by tile.
+        /// \details See image::read_region.
+        /*!
+         * \return 0 sucess; -1 Failed.
+         */
+        int read_region(
+            const int &timepoint, const int &channel, const int &z,
+            const cv::Rect &region, cv::Mat_<T> &destination)
+        {
+            cv::Mat untyped = destination;
+            int status = this->source.read_region(
+                timepoint, channel, z, region, untyped
+            );
+            destination = untyped;
+            return status;
+        }
+        /// Image accessed.
+        image &source;
+    };
+
+    /// \brief Streams the planes of an image of pixel type T.
+    /// \details Same as plane_iterator, with the byte swap for T
+    ///          resolved at compile time and planes returned as
+    ///          cv::Mat_<T>.
+    template <typename T>
+    class typed_plane_iterator
+    {
+    public:
+        /// Constructor. Issues the first requests.
+        /*!
+         * \param source image to read from.
+         * \throw std::invalid_argument if the image's pixel type is not T.
+         */
+        typed_plane_iterator(image &source)
+        {
+            if (source.pixel_type_cv != pixel_traits<T>::cv_type) {
+                throw std::invalid_argument(
+                    "Pixel type of the image is not T"
+                );
+            }
+            this->size_x = source.size_x;
+            this->size_y = source.size_y;
+            this->number_of_planes = source.timepoint_list.size() *
+                source.channel_list.size() * source.plane_list.size();
+            this->prefetcher = source.create_plane_prefetcher();
+        }
+        /// Destructor.
+        ~typed_plane_iterator() {delete this->prefetcher;}
+        /// \brief Waits for the next plane.
+        /*!
+         * \param plane Mat receiving the plane. It shares a buffer that is
+         *        reused by the next call; clone it to keep it.
+         * \param index position of the plane in the image.
+         * \return true if a plane was returned; false if all planes have
+         *         been read.
+         * \throw std::length_error if the server sent a short plane.
+         */
+        bool next(cv::Mat_<T> &plane, simple_omero::plane_index &index)
+        {
+            const Ice::Byte *bytes;
+            size_t size;
+            if (!this->prefetcher->next(bytes, size, index)) {
+                return false;
+            }
+            if (size < sizeof(T) * (size_t) this->size_x * this->size_y) {
+                throw std::length_error("Short plane");
+            }
+            this->buffer.create(this->size_y, this->size_x);
+            simple_omero::byte_swap<sizeof(T)>(
+                reinterpret_cast<const unsigned char *>(bytes),
+                this->buffer.data, (size_t) this->size_x * this->size_y
+            );
+            plane = this->buffer;
+            return true;
+        }
+        /// Number of planes returned by a full pass.
+        int number_of_planes;
+    private:
+        /// Not copyable, it owns the requests in flight.
+        typed_plane_iterator(const typed_plane_iterator &);
+        typed_plane_iterator &operator=(const typed_plane_iterator &);
+        /// Keeps the getPlane requests in flight.
+        simple_omero::plane_prefetcher *prefetcher;
+        /// Plane buffer handed out by next().
+        cv::Mat_<T> buffer;
+        /// Plane width.
+        int size_x;
+        /// Plane height.
+        int size_y;
+    };
+
+    /// \brief Calls functor with the typed_image matching the image's
+    ///        pixel type, so the functor's loops are compiled for it.
+    /// \details functor needs a template <typename T>
+    ///          void operator()(typed_image<T> &) member.
+    /*!
+     * \param source image to access.
+     * \param functor functor to call.
+     * \return 0 sucess; -1 if the pixel type has no typed_image.
+     */
+    template <class Functor>
+    int dispatch(image &source, Functor &functor)
+    {
+        switch (source.pixel_type_cv) {
+            case CV_8S: {
+                typed_image<signed char> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_8U: {
+                typed_image<unsigned char> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_16S: {
+                typed_image<short> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_16U: {
+                typed_image<unsigned short> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_32S: {
+                typed_image<int> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_32F: {
+                typed_image<float> typed(source);
+                functor(typed);
+                return 0;
+            }
+            case CV_64F: {
+                typed_image<double> typed(source);
+                functor(typed);
+                return 0;
+            }
+            default:
+                std::cout << "\tdispatch: Type not supported!!!!\n";
+                return -1;
+        }
+    }
+#endif //_omero2cv_typed_image_included_
+}
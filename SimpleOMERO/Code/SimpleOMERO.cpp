@@ -32,13 +32,28 @@ int simple_omero::connector::connect(
     if (error_code == -1)
         return -1;
     error_code = set_session();
-    if (error_code == -1)
-        return -1;
-    error_code = set_admin();
     if (error_code == -1)
         return -1;
     this->printSessionDetails();
-    this->get_session();
+    return 0;
+}
+
+
+int simple_omero::connector::join(
+    const std::string &host, const std::string &port,
+    const std::string &session_key)
+{
+    this->host = host;
+    this->port = port;
+    try {
+        this->client = new omero::client(initialize_connection_data());
+        this->session = this->client->joinSession(session_key);
+        this->session->detachOnDestroy();
+    } catch (...) {
+        std::cout << "\n" << this->log->date_time_now()
+                  << "Problem joining the session.\n\n";
+        return -1;
+    }
     return 0;
 }
 
@@ -46,11 +61,15 @@ int simple_omero::connector::connect(
 int simple_omero::connector::set_client()
 {
     try {
-        omero::client_ptr initialize_client =
+        omero::client_ptr login =
             new omero::client(initialize_connection_data());
-        omero::api::ServiceFactoryPrx session_new =
-            initialize_client->createSession();
-        client = initialize_client->createClient(false);
+        login->createSession();
+        if (this->encrypted) {
+            client = login;
+        } else {
+            client = login->createClient(false);
+            login_client = login;
+        }
     }
     catch (...) {
         std::cout << "\n" << this->log->date_time_now()
@@ -64,7 +83,6 @@ int simple_omero::connector::set_client()
 int simple_omero::connector::set_session()
 {
     try {
-        //session = client->createSession();
         session = client->getSession();
         session->closeOnDestroy();
     } catch (...) {
@@ -89,6 +107,24 @@ int simple_omero::connector::set_admin()
 }
 
 
+omero::api::IAdminPrx simple_omero::connector::get_admin()
+{
+    if (!admin) {
+        set_admin();
+    }
+    return admin;
+}
+
+
+omero::sys::EventContextPtr simple_omero::connector::get_event_context()
+{
+    if (!event_context) {
+        event_context = get_admin()->getEventContext();
+    }
+    return event_context;
+}
+
+
 Ice::InitializationData simple_omero::connector::initialize_connection_data()
 {
     Ice::InitializationData data;
@@ -97,15 +133,56 @@ Ice::InitializationData simple_omero::connector::initialize_connection_data()
     data.properties->setProperty( "omero.port", this->port );
     data.properties->setProperty( "omero.user", this->user );
     data.properties->setProperty( "omero.pass", this->pass );
+    apply_transport_profile(data.properties, this->transport);
     return data;
 }
 
 
+void simple_omero::apply_transport_profile(
+    const Ice::PropertiesPtr &properties, const transport_profile &profile)
+{
+    switch (profile) {
+        case lan_bulk_profile:
+            // Sizes in KB for Ice.MessageSizeMax, bytes for the sockets.
+            properties->setProperty("Ice.MessageSizeMax", "262144");
+            properties->setProperty("Ice.Override.Compress", "0");
+            properties->setProperty("Ice.ThreadPool.Client.Size", "4");
+            properties->setProperty("Ice.ThreadPool.Client.SizeMax", "16");
+            properties->setProperty("Ice.TCP.RcvSize", "4194304");
+            properties->setProperty("Ice.TCP.SndSize", "4194304");
+            // Keep connections open between batches of requests.
+            properties->setProperty("Ice.ACM.Client", "0");
+            break;
+        case wan_compressed_profile:
+            properties->setProperty("Ice.MessageSizeMax", "65536");
+            properties->setProperty("Ice.Override.Compress", "1");
+            properties->setProperty("Ice.ThreadPool.Client.Size", "2");
+            properties->setProperty("Ice.ThreadPool.Client.SizeMax", "8");
+            properties->setProperty("Ice.TCP.RcvSize", "4194304");
+            properties->setProperty("Ice.TCP.SndSize", "4194304");
+            properties->setProperty("Ice.ACM.Client", "0");
+            break;
+        case interactive_profile:
+            properties->setProperty("Ice.MessageSizeMax", "16384");
+            properties->setProperty("Ice.Override.Compress", "0");
+            properties->setProperty("Ice.ThreadPool.Client.Size", "1");
+            properties->setProperty("Ice.ThreadPool.Client.SizeMax", "4");
+            // Closing the Glacier2 router connection when idle would
+            // destroy the session, so keep it pinged instead.
+            properties->setProperty("Ice.ACM.Client", "0");
+            properties->setProperty("omero.keep_alive", "60");
+            break;
+        default:
+            break;
+    }
+}
+
+
 void simple_omero::connector::list_images_in_datasets()
 {
     omero::api::IContainerPrx container_service =
         this->session->getContainerService();
-    int userID = admin->getEventContext()->userId;
+    int userID = get_event_context()->userId;
     omero::sys::ParametersIPtr param = new omero::sys::ParametersI();
     param->exp(userID);
     param->leaves();
@@ -159,14 +236,314 @@ void simple_omero::connector::printSessionDetails()
               << " as " << user
               << "\n";
     std::cout << "--------\n";
-    std::cout << "User: " << admin->getEventContext()->userName << "\n"
-              << "Id: "   << admin->getEventContext()->userId << "\n"
-              << "Current group: " << admin->getEventContext()->groupName
+    omero::sys::EventContextPtr context = get_event_context();
+    std::cout << "User: " << context->userName << "\n"
+              << "Id: "   << context->userId << "\n"
+              << "Current group: " << context->groupName
               << "\n";
     std::cout << "---------\n";
 }
 
 
+namespace {
+    /// Pings the sessions of a session_pool.
+    class keep_alive_task : public IceUtil::TimerTask {
+        public:
+            keep_alive_task(simple_omero::session_pool *pool)
+            {
+                this->pool = pool;
+            }
+            virtual void runTimerTask()
+            {
+                this->pool->keep_alive();
+            }
+        private:
+            simple_omero::session_pool *pool;
+    };
+}
+
+
+simple_omero::session_pool::session_pool(
+    const std::string &host, const std::string &port,
+    const std::string &user, const std::string &pass,
+    const int &number_of_sessions, const int &keep_alive)
+{
+    this->host = host;
+    this->port = port;
+    this->user = user;
+    this->pass = pass;
+    for (int i = 0; i < number_of_sessions; i++) {
+        connector *session = new connector();
+        if (session->connect(host, port, user, pass) != 0) {
+            delete session;
+            continue;
+        }
+        this->connectors.push_back(session);
+        this->leases.push_back(0);
+    }
+    this->timer = new IceUtil::Timer();
+    this->timer->scheduleRepeated(
+        new keep_alive_task(this), IceUtil::Time::seconds(keep_alive)
+    );
+}
+
+
+simple_omero::session_pool::~session_pool()
+{
+    // Waits for a ping in progress.
+    this->timer->destroy();
+    for (size_t i = 0; i < this->connectors.size(); i++) {
+        try {
+            this->connectors.at(i)->get_client()->closeSession();
+        } catch (...) {
+        }
+        delete this->connectors.at(i);
+    }
+    for (size_t i = 0; i < this->retired.size(); i++) {
+        delete this->retired.at(i);
+    }
+}
+
+
+int simple_omero::session_pool::size()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->connectors.size();
+}
+
+
+int simple_omero::session_pool::acquire()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    int index = -1;
+    for (size_t i = 0; i < this->leases.size(); i++) {
+        if (index < 0 || this->leases.at(i) < this->leases.at(index)) {
+            index = i;
+        }
+    }
+    if (index >= 0) {
+        this->leases.at(index)++;
+    }
+    return index;
+}
+
+
+void simple_omero::session_pool::release(const int &index)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    this->leases.at(index)--;
+}
+
+
+omero::api::ServiceFactoryPrx simple_omero::session_pool::get_session(
+    const int &index)
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    return this->connectors.at(index)->get_session();
+}
+
+
+std::vector<omero::api::ServiceFactoryPrx>
+simple_omero::session_pool::get_sessions()
+{
+    IceUtil::Mutex::Lock lock(this->mutex);
+    std::vector<omero::api::ServiceFactoryPrx> sessions;
+    for (size_t i = 0; i < this->connectors.size(); i++) {
+        sessions.push_back(this->connectors.at(i)->get_session());
+    }
+    return sessions;
+}
+
+
+void simple_omero::session_pool::keep_alive()
+{
+    std::vector<omero::api::ServiceFactoryPrx> sessions = this->get_sessions();
+    for (size_t i = 0; i < sessions.size(); i++) {
+        try {
+            sessions.at(i)->keepAlive(omero::api::ServiceInterfacePrx());
+            continue;
+        } catch (...) {
+            simpleomero_log(simpleomero_log_warning,
+                "Session " << i << " expired, reconnecting."
+            );
+        }
+        connector *session = new connector();
+        if (session->connect(this->host, this->port,
+                             this->user, this->pass) != 0) {
+            delete session;
+            continue;
+        }
+        // Leases may still hold proxies of the old session.
+        IceUtil::Mutex::Lock lock(this->mutex);
+        this->retired.push_back(this->connectors.at(i));
+        this->connectors.at(i) = session;
+    }
+}
+
+
+simple_omero::pixel_store_pool::pixel_store_pool(
+    session_pool &sessions, const int &max_stores)
+{
+    this->sessions = &sessions;
+    this->max_stores = max_stores > 0 ? max_stores : 1;
+    this->leased = 0;
+    this->created_count = 0;
+    this->reused_count = 0;
+}
+
+
+simple_omero::pixel_store_pool::~pixel_store_pool()
+{
+    std::list<pooled_store>::iterator i;
+    for (i = this->idle.begin(); i != this->idle.end(); i++) {
+        this->close(*i);
+    }
+}
+
+
+void simple_omero::pixel_store_pool::close(const pooled_store &store)
+{
+    try {
+        store.store->close();
+    } catch (...) {
+    }
+    this->sessions->release(store.session);
+}
+
+
+omero::api::RawPixelsStorePrx simple_omero::pixel_store_pool::acquire(
+    const long long &pixels_id)
+{
+    pooled_store pooled;
+    pooled.pixels_id = pixels_id;
+    pooled.session = -1;
+    {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        while (this->leased >= this->max_stores) {
+            this->monitor.wait();
+        }
+        this->leased++;
+        std::list<pooled_store>::iterator i;
+        for (i = this->idle.begin(); i != this->idle.end(); i++) {
+            if (i->pixels_id == pixels_id) {
+                this->in_use.splice(this->in_use.end(), this->idle, i);
+                this->reused_count++;
+                return this->in_use.back().store;
+            }
+        }
+        if (this->leased + (int)this->idle.size() > this->max_stores) {
+            // Every store is open: point the least recently used one to
+            // the new pixels.
+            pooled.store = this->idle.back().store;
+            pooled.session = this->idle.back().session;
+            this->idle.pop_back();
+        }
+    }
+    if (pooled.store) {
+        try {
+            rpc_timer timer(rpc_set_pixels_id);
+            pooled.store->setPixelsId(pixels_id, false);
+            IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+            this->in_use.push_back(pooled);
+            return pooled.store;
+        } catch (...) {
+            this->close(pooled);
+        }
+    }
+    // The session stays leased while the store is open, so new stores
+    // spread over the sessions instead of piling up on one connection.
+    pooled.session = this->sessions->acquire();
+    try {
+        if (pooled.session < 0) {
+            throw std::runtime_error("No session connected");
+        }
+        pooled.store =
+            this->sessions->get_session(pooled.session)
+                ->createRawPixelsStore();
+        rpc_timer timer(rpc_set_pixels_id);
+        pooled.store->setPixelsId(pixels_id, false);
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        this->in_use.push_back(pooled);
+        this->created_count++;
+        return pooled.store;
+    } catch (...) {
+        simpleomero_log(simpleomero_log_error,
+            "RawPixelsStore for pixels " << pixels_id
+            << " could not be opened!!!!"
+        );
+    }
+    if (pooled.session >= 0) {
+        if (pooled.store) {
+            this->close(pooled);
+        } else {
+            this->sessions->release(pooled.session);
+        }
+    }
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    this->leased--;
+    this->monitor.notify();
+    return omero::api::RawPixelsStorePrx();
+}
+
+
+void simple_omero::pixel_store_pool::release(
+    const long long &pixels_id, const omero::api::RawPixelsStorePrx &store)
+{
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    std::list<pooled_store>::iterator i;
+    for (i = this->in_use.begin(); i != this->in_use.end(); i++) {
+        if (i->store == store) {
+            break;
+        }
+    }
+    if (i == this->in_use.end()) {
+        return;
+    }
+    i->pixels_id = pixels_id;
+    this->idle.splice(this->idle.begin(), this->in_use, i);
+    this->leased--;
+    this->monitor.notify();
+}
+
+
+void simple_omero::pixel_store_pool::discard(
+    const omero::api::RawPixelsStorePrx &store)
+{
+    pooled_store discarded;
+    {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+        std::list<pooled_store>::iterator i;
+        for (i = this->in_use.begin(); i != this->in_use.end(); i++) {
+            if (i->store == store) {
+                break;
+            }
+        }
+        if (i == this->in_use.end()) {
+            return;
+        }
+        discarded = *i;
+        this->in_use.erase(i);
+        this->leased--;
+        this->monitor.notify();
+    }
+    this->close(discarded);
+}
+
+
+long long simple_omero::pixel_store_pool::created()
+{
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    return this->created_count;
+}
+
+
+long long simple_omero::pixel_store_pool::reused()
+{
+    IceUtil::Monitor<IceUtil::Mutex>::Lock lock(this->monitor);
+    return this->reused_count;
+}
+
+
 simple_omero::image::image(
     const omero::api::ServiceFactoryPrx &session, const int &image_id)
 {
@@ -177,8 +554,116 @@ simple_omero::image::image(
     omero::api::ImageList image = container_service->getImages(
         "Image", id_list, new omero::sys::ParametersI());
     
-    this->Pointer = image.at(0);
+    this->set_up(image.at(0));
+    simpleomero_log(simpleomero_log_debug,
+        "Image " << this->id << ": " << this->name << ", "
+        << this->size_x << " x " << this->size_y << " x " << this->size_z
+    );
+}
+
+
+simple_omero::image::image(const omero::model::ImagePtr &loaded)
+{
+    this->set_up(loaded);
+}
+
+
+simple_omero::image::~image()
+{
+    // Returns a pooled store, so its slot is not lost.
+    if (this->store_pool != NULL) {
+        this->release_pixel_store();
+    }
+    delete this->source;
+}
+
+
+std::vector<simple_omero::image *> simple_omero::image::load_images(
+    const omero::api::ServiceFactoryPrx &session,
+    const std::vector<int> &image_ids)
+{
+    omero::api::IQueryPrx query_service = session->getQueryService();
+    std::map<int, omero::model::ImagePtr> loaded;
+    // Everything the constructor reads, in one query per batch.
+    std::string query =
+        "select i from Image i "
+        "join fetch i.pixels p "
+        "join fetch p.pixelsType "
+        "left outer join fetch p.details.updateEvent "
+        "where i.id in (:ids)";
+    for (size_t first = 0; first < image_ids.size();
+         first += simpleomero_load_batch_size) {
+        size_t last = first + simpleomero_load_batch_size;
+        if (last > image_ids.size()) {
+            last = image_ids.size();
+        }
+        omero::sys::LongList id_list(
+            image_ids.begin() + first, image_ids.begin() + last
+        );
+        omero::sys::ParametersIPtr parameters = new omero::sys::ParametersI();
+        parameters->addIds(id_list);
+        std::vector<omero::model::ImagePtr> images =
+            omero::cast<omero::model::ImagePtr>(
+                query_service->findAllByQuery(query, parameters)
+            );
+        for (size_t i = 0; i < images.size(); i++) {
+            loaded[images.at(i)->getId()->getValue()] = images.at(i);
+        }
+    }
+    std::vector<image *> handles;
+    for (size_t i = 0; i < image_ids.size(); i++) {
+        std::map<int, omero::model::ImagePtr>::iterator found =
+            loaded.find(image_ids.at(i));
+        if (found == loaded.end()) {
+            simpleomero_log(simpleomero_log_warning,
+                "Image " << image_ids.at(i) << " not found!!!!"
+            );
+            continue;
+        }
+        handles.push_back(new image(found->second));
+    }
+    return handles;
+}
+
+
+long long simple_omero::image::reload_update_event(
+    const omero::api::ServiceFactoryPrx &session)
+{
+    this->update_event = -1;
+    try {
+        omero::sys::ParametersIPtr parameters = new omero::sys::ParametersI();
+        parameters->addId(this->pixels_id);
+        std::vector<omero::model::PixelsPtr> pixels =
+            omero::cast<omero::model::PixelsPtr>(
+                session->getQueryService()->findAllByQuery(
+                    "select p from Pixels p "
+                    "left outer join fetch p.details.updateEvent "
+                    "where p.id = :id", parameters
+                )
+            );
+        this->update_event = pixels.at(0)->getDetails()->getUpdateEvent()
+            ->getId()->getValue();
+    } catch (...) {
+        simpleomero_log(simpleomero_log_warning,
+            "Update event of pixels " << this->pixels_id << " not read!!!!"
+        );
+    }
+    return this->update_event;
+}
+
+
+void simple_omero::image::set_up(const omero::model::ImagePtr &loaded)
+{
+    this->Pointer = loaded;
     this->id = this->Pointer->getId()->getValue();
+    this->pixels_id =
+        this->Pointer->getPrimaryPixels()->getId()->getValue();
+    try {
+        this->update_event = this->Pointer->getPrimaryPixels()
+            ->getDetails()->getUpdateEvent()->getId()->getValue();
+    } catch (...) {
+        this->update_event = -1;
+    }
     this->name = this->Pointer->getName()->getValue();
     try {
         this->description = this->Pointer->getDescription()->getValue();
@@ -204,7 +689,11 @@ simple_omero::image::image(
     } else {
         this->pixel_size_z = 0.0;
     }
-    this->print_details();
+    this->resolution_level = -1;
+    this->store_pool = NULL;
+    this->source = NULL;
+    this->level_size_x = this->size_x;
+    this->level_size_y = this->size_y;
 }
 
 
@@ -264,6 +753,14 @@ simple_omero::image::image(
     );
     //
     this->id = this->Pointer->getId()->getValue();
+    this->pixels_id =
+        this->Pointer->getPrimaryPixels()->getId()->getValue();
+    try {
+        this->update_event = this->Pointer->getPrimaryPixels()
+            ->getDetails()->getUpdateEvent()->getId()->getValue();
+    } catch (...) {
+        this->update_event = -1;
+    }
     this->name = this->Pointer->getName()->getValue();
     this->description = this->Pointer->getDescription()->getValue();
     this->pixel_type =
@@ -285,26 +782,156 @@ simple_omero::image::image(
     } else {
         this->pixel_size_z = 0.0;
     }
-    std::cout << "Created New Image\n";
-    this->print_details();
+    this->resolution_level = -1;
+    this->store_pool = NULL;
+    this->source = NULL;
+    this->level_size_x = this->size_x;
+    this->level_size_y = this->size_y;
+    simpleomero_log(simpleomero_log_debug,
+        "Created New Image " << this->id << ": " << this->name
+    );
 }
 
 
 void simple_omero::image::open_pixel_store(
     const omero::api::ServiceFactoryPrx &session)
 {
-    this->pixel_store = session->createRawPixelsStore();
-    this->pixel_store->setPixelsId(
+    this->release_pixel_store();
+    this->pixel_store = this->create_pixel_store(session);
+    this->source = new omero_pixel_source(this->pixel_store);
+}
+
+
+int simple_omero::image::open_pixel_source(pixel_source *source)
+{
+    if (source == NULL || !source->is_open()) {
+        return -1;
+    }
+    this->release_pixel_store();
+    this->source = source;
+    this->pixel_store = omero::api::RawPixelsStorePrx();
+    this->resolution_level = -1;
+    this->level_size_x = this->size_x;
+    this->level_size_y = this->size_y;
+    return 0;
+}
+
+
+omero::api::RawPixelsStorePrx simple_omero::image::create_pixel_store(
+    const omero::api::ServiceFactoryPrx &session)
+{
+    omero::api::RawPixelsStorePrx store = session->createRawPixelsStore();
+    rpc_timer timer(rpc_set_pixels_id);
+    store->setPixelsId(
         this->Pointer->getPrimaryPixels()->getId()->getValue(),
         false
     );
+    if (this->resolution_level >= 0) {
+        store->setResolutionLevel(this->resolution_level);
+    }
+    return store;
+}
+
+
+int simple_omero::image::get_resolution_levels()
+{
+    // Local sources hold full resolution only.
+    if (!this->pixel_store) {
+        return 1;
+    }
+    return this->pixel_store->getResolutionLevels();
+}
+
+
+void simple_omero::image::set_resolution_level(const int &level)
+{
+    int levels = this->get_resolution_levels();
+    if (levels > 1) {
+        this->pixel_store->setResolutionLevel(level);
+    }
+    if (level >= levels - 1) {
+        this->resolution_level = -1;
+        this->level_size_x = this->size_x;
+        this->level_size_y = this->size_y;
+        return;
+    }
+    // The store reports row and plane sizes at its current level.
+    int bpp = this->pixel_type->getBitSize()->getValue() / 8;
+    if (bpp < 1) {
+        bpp = 1;
+    }
+    int row_size;
+    {
+        rpc_timer timer(rpc_get_row_size);
+        row_size = this->pixel_store->getRowSize();
+    }
+    rpc_timer timer(rpc_get_plane_size);
+    int plane_size = this->pixel_store->getPlaneSize();
+    this->resolution_level = level;
+    this->level_size_x = row_size / bpp;
+    this->level_size_y = plane_size / row_size;
+}
+
+
+int simple_omero::image::open_pixel_store(pixel_store_pool &pool)
+{
+    // Returned first: acquire could wait on the slot held here.
+    this->release_pixel_store();
+    this->pixel_store = pool.acquire(this->pixels_id);
+    if (!this->pixel_store) {
+        return -1;
+    }
+    this->source = new omero_pixel_source(this->pixel_store);
+    this->store_pool = &pool;
+    this->resolution_level = -1;
+    this->level_size_x = this->size_x;
+    this->level_size_y = this->size_y;
+    return 0;
 }
 
 
 void simple_omero::image::close_pixel_store()
 {
-    this->pixel_store->save();
-    this->pixel_store->close();
+    if (this->source == NULL) {
+        return;
+    }
+    if (this->store_pool != NULL) {
+        pixel_store_pool *pool = this->store_pool;
+        this->store_pool = NULL;
+        try {
+            this->source->save();
+            if (this->resolution_level >= 0) {
+                this->set_resolution_level(this->get_resolution_levels() - 1);
+            }
+        } catch (...) {
+            // Not handed to the next lease in an unknown state.
+            pool->discard(this->pixel_store);
+            delete this->source;
+            this->source = NULL;
+            throw;
+        }
+        pool->release(this->pixels_id, this->pixel_store);
+    } else {
+        this->source->save();
+        this->source->close();
+    }
+    delete this->source;
+    this->source = NULL;
+}
+
+
+void simple_omero::image::release_pixel_store()
+{
+    try {
+        this->close_pixel_store();
+    } catch (...) {
+        simpleomero_log(simpleomero_log_warning,
+            "Pixels of image " << this->id << " not closed cleanly."
+        );
+    }
+    delete this->source;
+    this->source = NULL;
+    this->store_pool = NULL;
 }
 
 
@@ -315,27 +942,42 @@ void simple_omero::image::get_raw_pixels(
     unsigned char *image_cast, const int &plane, const int &channel,
     const int &time_point, const int &bpp)
 {
+    plane_index index;
+    index.plane = plane;
+    index.channel = channel;
+    index.time_point = time_point;
+    plane_cache *cache = plane_cache::shared;
+    if (cache != NULL && cache->fetch(
+            this->pixels_id, this->resolution_level, index, image_cast,
+            this->level_size_x, this->level_size_y, bpp)) {
+        return;
+    }
     std::vector<Ice::Byte> image_ice_container;
-    image_ice_container =
-        this->pixel_store->getPlane(
-            plane, channel, time_point
+    pixel_source::require_open(this->source)->get_plane(
+        plane, channel, time_point, image_ice_container
     );
-    if (bpp == 1) {
-        memcpy(
-            image_cast,
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            this->pixel_store->getPlaneSize()
-        );
-    }
-    else if (bpp > 1) {
-        std::reverse_copy(
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            reinterpret_cast<unsigned char *>(&image_ice_container[0])
-                + pixel_store->getPlaneSize(),
-            image_cast
+    copy_raw_pixels(
+        image_ice_container, image_cast, image_ice_container.size(), bpp
+    );
+    image_ice_container.clear();
+    if (cache != NULL) {
+        cache->store(
+            this->pixels_id, this->resolution_level, index, image_cast,
+            this->level_size_x, this->level_size_y, bpp
         );
     }
-    image_ice_container.clear();
+}
+
+
+void simple_omero::image::copy_raw_pixels(
+    const std::vector<Ice::Byte> &bytes, unsigned char *image_cast,
+    const int &size, const int &bpp)
+{
+    rpc_timer timer(rpc_decode, size);
+    byte_swap(
+        reinterpret_cast<const unsigned char *>(&bytes[0]), image_cast,
+        size / bpp, bpp
+    );
 }
 
 
@@ -347,31 +989,31 @@ unsigned char *simple_omero::image::get_raw_pixels(
     omero::api::RawPixelsStorePrx pixel_store;
     std::vector<Ice::Byte> image_ice_container;
     pixel_store = session->createRawPixelsStore();
-    pixel_store->setPixelsId(
-        image->getPrimaryPixels()->getId()->getValue(), false
-    );
-    image_ice_container = pixel_store->getPlane(
-        plane, channel, time_point
-    );
-    unsigned char *image_cast =
-        (unsigned char *) malloc (pixel_store->getPlaneSize());
-    int pixel_size =
-        image->getPrimaryPixels()->getPixelsType()->getBitSize()->getValue();
-    if (pixel_size == 1) {
-        memcpy(
-            image_cast,
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            pixel_store->getPlaneSize()
+    {
+        rpc_timer timer(rpc_set_pixels_id);
+        pixel_store->setPixelsId(
+            image->getPrimaryPixels()->getId()->getValue(), false
         );
     }
-    else if (pixel_size > 1) {
-        std::reverse_copy(
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            reinterpret_cast<unsigned char *>(&image_ice_container[0])
-                + pixel_store->getPlaneSize(),
-            image_cast
+    {
+        rpc_timer timer(rpc_get_plane);
+        image_ice_container = pixel_store->getPlane(
+            plane, channel, time_point
         );
+        timer.bytes = image_ice_container.size();
+    }
+    int plane_size;
+    {
+        rpc_timer timer(rpc_get_plane_size);
+        plane_size = pixel_store->getPlaneSize();
     }
+    unsigned char *image_cast = (unsigned char *) malloc (plane_size);
+    int pixel_size =
+        image->getPrimaryPixels()->getPixelsType()->getBitSize()->getValue();
+    copy_raw_pixels(
+        image_ice_container, image_cast, image_ice_container.size(),
+        pixel_size / 8 > 1 ? pixel_size / 8 : 1
+    );
     pixel_store->close();
     return image_cast;
 }
@@ -382,60 +1024,358 @@ void simple_omero::image::get_raw_pixels_hyper_cube(
     const int &start_y, const int &end_y, const int &step_y,
     const int &start_z, const int &end_z, const int &bpp)
 {
-    omero::sys::IntList offset;
-    offset.push_back(start_x);
-    offset.push_back(start_y);
-    offset.push_back(start_z);
-    omero::sys::IntList size;
-    size.push_back(end_x - start_x);
-    size.push_back(end_y - start_y);
-    size.push_back(end_z - start_z);
-    omero::sys::IntList step;
-    step.push_back(1);
-    step.push_back(1);
-    step.push_back(1);
+    hyper_cube cube;
+    cube.offset[hyper_cube::x] = start_x;
+    cube.offset[hyper_cube::y] = start_y;
+    cube.offset[hyper_cube::z] = start_z;
+    cube.offset[hyper_cube::c] = 0;
+    cube.offset[hyper_cube::t] = 0;
+    cube.size[hyper_cube::x] = end_x - start_x;
+    cube.size[hyper_cube::y] = end_y - start_y;
+    cube.size[hyper_cube::z] = end_z - start_z;
+    cube.size[hyper_cube::c] = 1;
+    cube.size[hyper_cube::t] = 1;
+    for (int d = 0; d < 5; d++) {
+        cube.step[d] = 1;
+    }
+    cube.step[hyper_cube::y] = step_y > 0 ? step_y : 1;
+    this->get_raw_pixels_hyper_cube(image_cast, cube, bpp);
+}
+
+
+void simple_omero::image::get_raw_pixels_hyper_cube(
+    unsigned char *image_cast, const hyper_cube &cube, const int &bpp)
+{
     std::vector<Ice::Byte> image_ice_container;
-    image_ice_container = this->pixel_store->getHypercube(offset, size, step);
-    int hyper_cube_size =
-        bpp * (end_x - start_x) * (end_y - start_y) * (end_z - start_z);
-    if (bpp == 1) {
-        memcpy(image_cast,
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            hyper_cube_size
-        );
+    this->get_hyper_cube_bytes(cube, image_ice_container, bpp);
+    copy_raw_pixels(
+        image_ice_container, image_cast, cube.count() * bpp, bpp
+    );
+}
+
+
+void simple_omero::image::get_hyper_cube_bytes(
+    const hyper_cube &cube, std::vector<Ice::Byte> &bytes, const int &bpp)
+{
+    if (!this->contains(cube)) {
+        throw std::out_of_range("Hypercube outside the image");
     }
-    else if (bpp > 1) {
-        std::reverse_copy(
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            reinterpret_cast<unsigned char *>(&image_ice_container[0])
-            + hyper_cube_size, image_cast
-        );
+    pixel_source::require_open(this->source)->get_hyper_cube(
+        cube.offset, cube.size, cube.step, bytes
+    );
+    // A short reply would leave the rest of the caller's buffer unset.
+    if ((long long) bytes.size() < cube.count() * bpp) {
+        throw std::length_error("Short hypercube reply");
     }
 }
 
 
+bool simple_omero::image::contains(const hyper_cube &cube)
+{
+    int bounds[5] = {
+        this->level_size_x, this->level_size_y, (int) this->size_z,
+        this->number_of_channels, this->number_of_timepoints
+    };
+    return cube.fits(bounds);
+}
+
+
+void simple_omero::image::get_raw_pixels_tile(
+    unsigned char *image_cast, const int &plane, const int &channel,
+    const int &time_point, const int &x, const int &y, const int &width,
+    const int &height, const int &bpp)
+{
+    std::vector<Ice::Byte> image_ice_container;
+    pixel_source::require_open(this->source)->get_tile(
+        plane, channel, time_point, x, y, width, height, image_ice_container
+    );
+    copy_raw_pixels(
+        image_ice_container, image_cast, image_ice_container.size(), bpp
+    );
+}
+
+
+void simple_omero::image::get_tile_size(int &width, int &height)
+{
+    pixel_source::require_open(this->source)->get_tile_size(width, height);
+}
+
+
 void simple_omero::image::get_raw_pixels_row(
     unsigned char *image_cast, const int &row, const int &plane,
     const int &channel, const int &time_point, const int &bpp)
 {
     std::vector<Ice::Byte> image_ice_container;
-    image_ice_container =
-        this->pixel_store->getRow(row, plane, channel, time_point);
-    if (bpp == 1) {
-        memcpy(
-            image_cast,
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            this->pixel_store->getRowSize()
+    pixel_source::require_open(this->source)->get_row(
+        row, plane, channel, time_point, image_ice_container
+    );
+    copy_raw_pixels(
+        image_ice_container, image_cast, image_ice_container.size(), bpp
+    );
+}
+
+
+namespace
+{
+    /// Splits planes into the requests reading them: getTimepoint or
+    /// getStack for runs forming whole time points or stacks in the
+    /// order OMERO stores them, getPlane otherwise.
+    std::vector<simple_omero::plane_block> group_planes(
+        const std::vector<simple_omero::plane_index> &planes,
+        const int &size_z, const int &size_c, const long long &plane_size,
+        const long long &max_block_size)
+    {
+        std::vector<simple_omero::plane_block> blocks;
+        size_t stack = size_z > 0 ? size_z : 1;
+        size_t timepoint = stack * (size_c > 0 ? size_c : 1);
+        bool stacks =
+            stack > 1 && plane_size * (long long) stack <= max_block_size;
+        bool timepoints = size_c > 1 && stacks &&
+            plane_size * (long long) timepoint <= max_block_size;
+        simple_omero::plane_block block;
+        size_t i = 0;
+        while (i < planes.size()) {
+            block.first = i;
+            block.kind = simple_omero::plane_transfer;
+            block.count = 1;
+            const simple_omero::plane_index &first = planes.at(i);
+            if (first.plane == 0 && stacks) {
+                size_t run = 1;
+                size_t longest = timepoints && first.channel == 0 ?
+                    timepoint : stack;
+                // Planes of a time point follow each other z fastest.
+                while (run < longest && i + run < planes.size()) {
+                    const simple_omero::plane_index &next =
+                        planes.at(i + run);
+                    if (next.time_point != first.time_point ||
+                        next.channel != (int) (run / stack) + first.channel ||
+                        next.plane != (int) (run % stack)) {
+                        break;
+                    }
+                    run++;
+                }
+                if (timepoints && run == timepoint) {
+                    block.kind = simple_omero::timepoint_transfer;
+                    block.count = run;
+                } else if (stacks && run >= stack) {
+                    block.kind = simple_omero::stack_transfer;
+                    block.count = stack;
+                }
+            }
+            blocks.push_back(block);
+            i += block.count;
+        }
+        return blocks;
+    }
+}
+
+
+simple_omero::plane_prefetcher::plane_prefetcher(
+    const omero::api::RawPixelsStorePrx &pixel_store,
+    const std::vector<plane_index> &planes, const int &depth,
+    const int &size_z, const int &size_c, const long long &plane_size)
+{
+    this->pixel_store = pixel_store;
+    this->source = NULL;
+    this->set_up(planes, depth, size_z, size_c, plane_size);
+}
+
+
+simple_omero::plane_prefetcher::plane_prefetcher(
+    pixel_source *source, const std::vector<plane_index> &planes,
+    const int &depth, const int &size_z, const int &size_c,
+    const long long &plane_size)
+{
+    this->pixel_store = pixel_source::require_open(source)->get_pixel_store();
+    this->source = source;
+    this->set_up(planes, depth, size_z, size_c, plane_size);
+}
+
+
+void simple_omero::plane_prefetcher::set_up(
+    const std::vector<plane_index> &planes, const int &depth,
+    const int &size_z, const int &size_c, const long long &plane_size)
+{
+    long long max_block_size = 0;
+    if (this->pixel_store && size_z > 0 && plane_size > 0) {
+        max_block_size = image::get_max_block_size(this->pixel_store);
+    }
+    this->block_returned = 0;
+    this->current_block.count = 0;
+    request_queue<plane_block, plane_index>::set_up(
+        planes,
+        group_planes(planes, size_z, size_c, plane_size, max_block_size),
+        depth
+    );
+}
+
+
+Ice::AsyncResultPtr simple_omero::plane_prefetcher::begin(
+    const plane_block &block)
+{
+    const plane_index &index = this->indices.at(block.first);
+    switch (block.kind) {
+        case timepoint_transfer:
+            return this->pixel_store->begin_getTimepoint(index.time_point);
+        case stack_transfer:
+            return this->pixel_store->begin_getStack(
+                index.channel, index.time_point
+            );
+        default:
+            return this->pixel_store->begin_getPlane(
+                index.plane, index.channel, index.time_point
+            );
+    }
+}
+
+
+size_t simple_omero::plane_prefetcher::weight(const plane_block &block)
+{
+    return block.count;
+}
+
+
+bool simple_omero::plane_prefetcher::next(
+    std::vector<Ice::Byte> &bytes, plane_index &index)
+{
+    if (!this->receive()) {
+        return false;
+    }
+    index = this->indices.at(
+        this->current_block.first + this->block_returned
+    );
+    if (this->current_block.count == 1) {
+        // Swap rather than assign so the plane is not copied again.
+        bytes.swap(this->block_bytes);
+        this->block_returned++;
+        return true;
+    }
+    size_t plane_size = this->block_bytes.size() / this->current_block.count;
+    std::vector<Ice::Byte>::const_iterator start =
+        this->block_bytes.begin() + this->block_returned * plane_size;
+    rpc_timer timer(rpc_copy, plane_size);
+    bytes.assign(start, start + plane_size);
+    this->block_returned++;
+    return true;
+}
+
+
+bool simple_omero::plane_prefetcher::next(
+    const Ice::Byte *&plane, size_t &plane_size, plane_index &index)
+{
+    if (!this->receive()) {
+        return false;
+    }
+    index = this->indices.at(
+        this->current_block.first + this->block_returned
+    );
+    plane_size = this->block_bytes.size() / this->current_block.count;
+    plane = this->block_bytes.empty() ? NULL :
+        &this->block_bytes[0] + this->block_returned * plane_size;
+    this->block_returned++;
+    return true;
+}
+
+
+bool simple_omero::plane_prefetcher::receive()
+{
+    if (this->block_returned < this->current_block.count) {
+        return true;
+    }
+    plane_block block;
+    if (!this->pixel_store) {
+        if (!this->next_local(block)) {
+            return false;
+        }
+        const plane_index &index = this->indices.at(block.first);
+        this->source->get_plane(
+            index.plane, index.channel, index.time_point, this->block_bytes
         );
+        this->current_block = block;
+        this->block_returned = 0;
+        return true;
     }
-    else if (bpp > 1) {
-        std::reverse_copy(
-            reinterpret_cast<unsigned char *>(&image_ice_container[0]),
-            reinterpret_cast<unsigned char *>(&image_ice_container[0])
-                + pixel_store->getRowSize(),
-            image_cast
+    Ice::AsyncResultPtr result;
+    long long started;
+    if (!this->pop(result, started, block)) {
+        return false;
+    }
+    rpc_timer timer(
+        block.kind == timepoint_transfer ? rpc_get_timepoint :
+        block.kind == stack_transfer ? rpc_get_stack : rpc_get_plane
+    );
+    timer.start = started;
+    switch (block.kind) {
+        case timepoint_transfer:
+            this->pixel_store->end_getTimepoint(result)
+                .swap(this->block_bytes);
+            break;
+        case stack_transfer:
+            this->pixel_store->end_getStack(result).swap(this->block_bytes);
+            break;
+        default:
+            this->pixel_store->end_getPlane(result).swap(this->block_bytes);
+    }
+    timer.bytes = this->block_bytes.size();
+    this->current_block = block;
+    this->block_returned = 0;
+    return true;
+}
+
+
+simple_omero::tile_prefetcher::tile_prefetcher(
+    const omero::api::RawPixelsStorePrx &pixel_store,
+    const std::vector<tile_index> &tiles, const int &depth)
+{
+    this->pixel_store = pixel_store;
+    this->source = NULL;
+    this->set_up(tiles, tiles, depth);
+}
+
+
+simple_omero::tile_prefetcher::tile_prefetcher(
+    pixel_source *source, const std::vector<tile_index> &tiles,
+    const int &depth)
+{
+    this->pixel_store = pixel_source::require_open(source)->get_pixel_store();
+    this->source = source;
+    this->set_up(tiles, tiles, depth);
+}
+
+
+Ice::AsyncResultPtr simple_omero::tile_prefetcher::begin(
+    const tile_index &tile)
+{
+    return this->pixel_store->begin_getTile(
+        tile.plane, tile.channel, tile.time_point,
+        tile.x, tile.y, tile.width, tile.height
+    );
+}
+
+
+bool simple_omero::tile_prefetcher::next(
+    std::vector<Ice::Byte> &bytes, tile_index &index)
+{
+    if (!this->pixel_store) {
+        if (!this->next_local(index)) {
+            return false;
+        }
+        this->source->get_tile(
+            index.plane, index.channel, index.time_point, index.x, index.y,
+            index.width, index.height, bytes
         );
+        return true;
+    }
+    Ice::AsyncResultPtr result;
+    long long started;
+    if (!this->pop(result, started, index)) {
+        return false;
     }
+    rpc_timer timer(rpc_get_tile);
+    timer.start = started;
+    this->pixel_store->end_getTile(result).swap(bytes);
+    timer.bytes = bytes.size();
+    return true;
 }
 
 
@@ -443,29 +1383,273 @@ void simple_omero::image::get_raw_pixels_row(
 
 
 void simple_omero::image::write_plane(
-    unsigned char *buffer, int bpp,
+    const unsigned char *buffer, int bpp,
     const int &timepoint, const int &channel, const int &plane)
 {
     int size = bpp * this->size_x * this->size_y;
     std::vector<Ice::Byte> bytes;
     bytes.resize(size);
-    if (bpp == 1) {
-        std::copy(
-            reinterpret_cast<Ice::Byte *>(buffer),
-            reinterpret_cast<Ice::Byte *>(buffer) + size,
-            bytes.begin()
+    {
+        // Conversion from native pixels to BIG_ENDIAN (OMERO).
+        rpc_timer timer(rpc_decode, size);
+        byte_swap(buffer, &bytes[0], size / bpp, bpp);
+    }
+    pixel_source::require_open(this->source)->set_plane(
+        bytes, plane, channel, timepoint
+    );
+    // Keep the shared cache in step with the server.
+    if (plane_cache::shared != NULL && this->resolution_level < 0) {
+        plane_index index;
+        index.plane = plane;
+        index.channel = channel;
+        index.time_point = timepoint;
+        plane_cache::shared->store(
+            this->pixels_id, -1, index, buffer, this->size_x, this->size_y,
+            bpp
+        );
+    }
+}
+
+
+simple_omero::plane_writer::plane_writer(
+    const omero::api::RawPixelsStorePrx &pixel_store,
+    const long long &pixels_id, const int &depth, const int &size_z,
+    const int &size_c)
+{
+    this->pixel_store = pixel_store;
+    this->source = NULL;
+    this->set_up(pixels_id, depth, size_z, size_c);
+}
+
+
+simple_omero::plane_writer::plane_writer(
+    pixel_source *source, const long long &pixels_id, const int &depth,
+    const int &size_z, const int &size_c)
+{
+    this->pixel_store = pixel_source::require_open(source)->get_pixel_store();
+    this->source = source;
+    this->set_up(pixels_id, depth, size_z, size_c);
+}
+
+
+void simple_omero::plane_writer::set_up(
+    const long long &pixels_id, const int &depth, const int &size_z,
+    const int &size_c)
+{
+    this->pixels_id = pixels_id;
+    this->depth = depth > 0 ? depth : 1;
+    this->size_z = size_z;
+    this->size_c = size_c > 0 ? size_c : 1;
+    this->max_block_size = 0;
+    // Local sources are written plane by plane. The server's
+    // Ice.MessageSizeMax, which cannot be queried, limits uploads.
+    if (this->size_z > 1 && this->pixel_store) {
+        this->max_block_size = std::min(
+            image::get_max_block_size(this->pixel_store),
+            (long long) simpleomero_max_upload_block
+        );
+    }
+    this->pending_kind = plane_transfer;
+    this->pending_plane_size = 0;
+    this->pending_count = 0;
+}
+
+
+simple_omero::plane_writer::~plane_writer()
+{
+    this->flush();
+}
+
+
+void simple_omero::plane_writer::write(
+    const unsigned char *buffer, const int &width, const int &height,
+    const int &bpp, const plane_index &index)
+{
+    size_t size = width * height * bpp;
+    if (!this->pending.empty() &&
+        (size != this->pending_plane_size || !this->continues_block(index))) {
+        this->send_pending();
+    }
+    if (this->pending.empty() && index.plane == 0 && this->size_z > 1) {
+        long long stack = (long long) size * this->size_z;
+        if (index.channel == 0 && this->size_c > 1 &&
+            stack * this->size_c <= this->max_block_size) {
+            this->pending_kind = timepoint_transfer;
+            this->pending_count = this->size_z * this->size_c;
+        } else if (stack <= this->max_block_size) {
+            this->pending_kind = stack_transfer;
+            this->pending_count = this->size_z;
+        }
+    }
+    if (this->pending.empty() && this->pending_kind == plane_transfer) {
+        this->bytes.resize(size);
+        // Conversion from native pixels to BIG_ENDIAN (OMERO).
+        rpc_timer timer(rpc_decode, size);
+        byte_swap(buffer, &this->bytes[0], size / bpp, bpp);
+        this->send(
+            this->bytes, plane_transfer, std::vector<plane_index>(1, index)
+        );
+    } else {
+        // Gather the plane into its place in the block.
+        this->pending_plane_size = size;
+        this->bytes.resize(size * this->pending_count);
+        rpc_timer timer(rpc_decode, size);
+        byte_swap(
+            buffer, &this->bytes[size * this->pending.size()], size / bpp, bpp
         );
+        this->pending.push_back(index);
+        if (this->pending.size() == this->pending_count) {
+            this->send(this->bytes, this->pending_kind, this->pending);
+            this->pending.clear();
+            this->pending_kind = plane_transfer;
+        }
+    }
+    if (plane_cache::shared != NULL) {
+        plane_cache::shared->store(
+            this->pixels_id, -1, index, buffer, width, height, bpp
+        );
+    }
+}
+
+
+bool simple_omero::plane_writer::continues_block(const plane_index &index)
+{
+    const plane_index &last = this->pending.back();
+    if (index.time_point != last.time_point) {
+        return false;
+    }
+    if (last.plane + 1 < this->size_z) {
+        return index.channel == last.channel &&
+            index.plane == last.plane + 1;
+    }
+    return this->pending_kind == timepoint_transfer &&
+        index.channel == last.channel + 1 && index.plane == 0;
+}
+
+
+void simple_omero::plane_writer::send_pending()
+{
+    std::vector<plane_index> planes;
+    planes.swap(this->pending);
+    this->pending_kind = plane_transfer;
+    std::vector<Ice::Byte> plane;
+    for (size_t i = 0; i < planes.size(); i++) {
+        std::vector<Ice::Byte>::const_iterator start =
+            this->bytes.begin() + i * this->pending_plane_size;
+        plane.assign(start, start + this->pending_plane_size);
+        this->send(
+            plane, plane_transfer, std::vector<plane_index>(1, planes.at(i))
+        );
+    }
+}
+
+
+void simple_omero::plane_writer::send(
+    const std::vector<Ice::Byte> &bytes, const transfer_kind &kind,
+    const std::vector<plane_index> &planes)
+{
+    const plane_index &index = planes.at(0);
+    if (!this->pixel_store) {
+        try {
+            this->source->set_plane(
+                bytes, index.plane, index.channel, index.time_point
+            );
+        } catch (...) {
+            this->failed.push_back(index);
+        }
+        return;
+    }
+    while (this->in_flight.size() >= this->depth) {
+        this->complete_oldest();
     }
-    else if (bpp > 1) {
-        std::reverse_copy(
-            reinterpret_cast<Ice::Byte *>(buffer),
-            reinterpret_cast<Ice::Byte *>(buffer) + size,
-            bytes.begin());
+    long long started = rpc_stats::now();
+    try {
+        switch (kind) {
+            case timepoint_transfer:
+                this->in_flight.push_back(
+                    this->pixel_store->begin_setTimepoint(
+                        bytes, index.time_point
+                    )
+                );
+                break;
+            case stack_transfer:
+                this->in_flight.push_back(
+                    this->pixel_store->begin_setStack(
+                        bytes, 0, index.channel, index.time_point
+                    )
+                );
+                break;
+            default:
+                this->in_flight.push_back(
+                    this->pixel_store->begin_setPlane(
+                        bytes, index.plane, index.channel, index.time_point
+                    )
+                );
+        }
+    } catch (...) {
+        this->failed.insert(this->failed.end(), planes.begin(), planes.end());
+        return;
+    }
+    this->in_flight_kinds.push_back(kind);
+    this->in_flight_planes.push_back(planes);
+    this->in_flight_started.push_back(started);
+    this->in_flight_bytes.push_back(bytes.size());
+}
+
+
+void simple_omero::plane_writer::complete_oldest()
+{
+    Ice::AsyncResultPtr result = this->in_flight.front();
+    transfer_kind kind = this->in_flight_kinds.front();
+    std::vector<plane_index> planes;
+    planes.swap(this->in_flight_planes.front());
+    rpc_operation operation = kind == timepoint_transfer ?
+        rpc_set_timepoint : kind == stack_transfer ?
+            rpc_set_stack : rpc_set_plane;
+    rpc_timer timer(operation, this->in_flight_bytes.front());
+    timer.start = this->in_flight_started.front();
+    this->in_flight.pop_front();
+    this->in_flight_kinds.pop_front();
+    this->in_flight_planes.pop_front();
+    this->in_flight_started.pop_front();
+    this->in_flight_bytes.pop_front();
+    try {
+        switch (kind) {
+            case timepoint_transfer:
+                this->pixel_store->end_setTimepoint(result);
+                break;
+            case stack_transfer:
+                this->pixel_store->end_setStack(result);
+                break;
+            default:
+                this->pixel_store->end_setPlane(result);
+        }
+    } catch (...) {
+        timer.failed = true;
+        this->failed.insert(this->failed.end(), planes.begin(), planes.end());
     }
-    pixel_store->setPlane(bytes, plane, channel, timepoint);
 }
 
 
+std::vector<simple_omero::plane_index> simple_omero::plane_writer::flush()
+{
+    this->send_pending();
+    while (!this->in_flight.empty()) {
+        this->complete_oldest();
+    }
+    std::vector<plane_index> failed;
+    failed.swap(this->failed);
+    // The cache may hold planes the server never received.
+    if (!failed.empty() && plane_cache::shared != NULL) {
+        plane_cache::shared->invalidate(this->pixels_id);
+    }
+    return failed;
+}
+
+
+simple_omero::plane_cache *simple_omero::plane_cache::shared = NULL;
+
+
 void simple_omero::image::print_details()
 {
     // Image Description
@@ -497,6 +1681,23 @@ void simple_omero::image::print_details()
 }
 
 
+long long simple_omero::image::get_max_block_size(
+    const omero::api::RawPixelsStorePrx &pixel_store)
+{
+    // Ice.MessageSizeMax is in KB; keep 64 KB for the request framing.
+    long long message_size_max = pixel_store->ice_getCommunicator()
+        ->getProperties()->getPropertyAsIntWithDefault(
+            "Ice.MessageSizeMax", 1024
+        );
+    // Too small for a block, or 0 for no limit which the other end
+    // may not share: read and write plane by plane.
+    if (message_size_max <= 64) {
+        return 0;
+    }
+    return (message_size_max - 64) * 1024;
+}
+
+
 std::string simple_omero::image::zero_pad_number(
     const int &padding, const int &num)
 {
@@ -19,6 +19,11 @@
 
 #include "SimpleOMERO_Headers.h"
 #include <vector>
+#include <map>
+#include <list>
+#include <deque>
+#include <stdexcept>
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <iomanip>
@@ -27,11 +32,44 @@
 #include <fstream>
 #include <unistd.h>
 #include "logger.h"
+#include <IceUtil/Monitor.h>
+#include <IceUtil/Mutex.h>
+#include <IceUtil/Timer.h>
+#include "byte_swap.h"
+#include "rpc_stats.h"
+#include "pixel_source.h"
 
 
 namespace simple_omero {
 #ifndef _simpleomero_connector_included_
 #define _simpleomero_connector_included_ 
+    /// Coherent sets of Ice transport properties, one per kind of link to
+    /// the server.
+    enum transport_profile {
+        /// Ice defaults.
+        default_profile,
+        /// Fast local network: 256 MB messages so whole stacks fit in one
+        /// request, no compression, more client threads for concurrent
+        /// stores and large socket buffers.
+        lan_bulk_profile,
+        /// Slow or metered link: compressed messages and large socket
+        /// buffers to fill long round trips.
+        wan_compressed_profile,
+        /// Viewers and other small requests: no compression, a small
+        /// client thread pool and the session pinged every minute so it
+        /// survives idle periods.
+        interactive_profile
+    };
+    /// \brief Sets the Ice properties of a transport profile.
+    /*!
+     * \param properties properties to set, before the communicator is
+     *        initialised with them.
+     * \param profile profile to apply.
+     */
+    void apply_transport_profile(
+        const Ice::PropertiesPtr &properties, const transport_profile &profile
+    );
+
     /// Simple connection to OMERO server
     class connector {
         public:
@@ -39,6 +77,8 @@ namespace simple_omero {
             connector()
             {
                 this->log = new logger();
+                this->encrypted = false;
+                this->transport = default_profile;
             }
             /// \brief Constructor with connection. No need to call connect().
             /*!
@@ -46,14 +86,18 @@ namespace simple_omero {
             * \param port Port Number.
             * \param user User Name.
             * \param pass User Password.
+            * \param profile Ice transport properties to connect with.
             * \return  0 sucess; -1 Failed.
             */
             
             connector(
                 const std::string &host , const std::string &port,
-                const std::string &user, const std::string &pass)
+                const std::string &user, const std::string &pass,
+                const transport_profile &profile = default_profile)
             {
                 this->log = new logger();
+                this->encrypted = false;
+                this->transport = profile;
                 this->connect(host, port, user, pass);
             }
             /// \brief Connects to omero server
@@ -68,12 +112,38 @@ namespace simple_omero {
                 const std::string &host, const std::string &port,
                 const std::string &user, const std::string &pass
             );
+            /// \brief Joins an existing session instead of logging in.
+            /// \details A single joinSession call and no further round
+            ///          trips, for short lived workers sharing the session
+            ///          of a parent process. The session is detached, not
+            ///          closed, when the connector goes away.
+            /*!
+            * \param host Server Address.
+            * \param port Port Number.
+            * \param session_key key of the session, from get_session_key.
+            * \return  0 sucess; -1 Failed.
+            */
+            int join(
+                const std::string &host, const std::string &port,
+                const std::string &session_key
+            );
+            /// Key other processes can join the session with.
+            std::string get_session_key() {return client->getSessionId();};
             /// Omero client getter.
             omero::client_ptr get_client() {return client;};
             /// Omero session getter.
             omero::api::ServiceFactoryPrx get_session() {return session;};
-            /// Omero admin getter.
-            omero::api::IAdminPrx get_admin() {return admin;};
+            /// Omero admin getter. The service is looked up on first use.
+            omero::api::IAdminPrx get_admin();
+            /// Event context of the session, fetched once on first use.
+            omero::sys::EventContextPtr get_event_context();
+            /// If true, connect keeps the SSL connection it logs in with
+            /// rather than switching to an unencrypted one, which takes a
+            /// second client joining the session. false by default.
+            bool encrypted;
+            /// Ice transport properties connect and join use.
+            /// default_profile by default.
+            transport_profile transport;
             /// Prints session details to console.
             void printSessionDetails();
             /// Prints to console list of user's datasets and images. 
@@ -87,6 +157,11 @@ namespace simple_omero {
             omero::api::ServiceFactoryPrx session;
             /// Omero admin instace.
             omero::api::IAdminPrx admin;
+            /// Event context of the session; null until first used.
+            omero::sys::EventContextPtr event_context;
+            /// Client that logged in, kept alive while client uses an
+            /// unencrypted connection to its session.
+            omero::client_ptr login_client;
             /// Omero client setter.
             int set_client();
             /// Omero admin setter.
@@ -107,8 +182,237 @@ namespace simple_omero {
     };
 #endif //_simpleomero_connector_included_
 
+#ifndef _simpleomero_hyper_cube_included_
+#define _simpleomero_hyper_cube_included_
+    /// \brief Strided 5D region of an image, as read by getHypercube.
+    /// \details Arrays are indexed by dimension in XYZCT order, e.g.
+    ///          offset[hyper_cube::z]. Pixels come back x fastest, then
+    ///          y, z, c and t.
+    struct hyper_cube {
+        /// Array index of each dimension.
+        enum dimension {x = 0, y, z, c, t};
+        /// First pixel, row, plane, channel and time point.
+        int offset[5];
+        /// Number of pixels, rows, planes, channels and time points
+        /// covered, before stepping.
+        int size[5];
+        /// Step in each dimension; 1 reads every pixel.
+        int step[5];
+        /// Number of elements read in a dimension.
+        int extent(const int &dimension) const
+        {
+            return (this->size[dimension] + this->step[dimension] - 1) /
+                this->step[dimension];
+        }
+        /// \brief True if the cube is not empty, its steps are positive
+        ///        and it lies within bounds.
+        /*!
+         * \param bounds size of the image in each dimension.
+         */
+        bool fits(const int bounds[5]) const
+        {
+            for (int d = 0; d < 5; d++) {
+                if (this->size[d] <= 0 || this->step[d] <= 0 ||
+                    this->offset[d] < 0 ||
+                    this->offset[d] + this->size[d] > bounds[d]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        /// Number of pixels read.
+        long long count() const
+        {
+            long long pixels = 1;
+            for (int d = 0; d < 5; d++) {
+                pixels *= this->extent(d);
+            }
+            return pixels;
+        }
+    };
+#endif //_simpleomero_hyper_cube_included_
+
+#ifndef _simpleomero_session_pool_included_
+#define _simpleomero_session_pool_included_
+/// Default seconds between keep-alive pings of a session_pool.
+#define simpleomero_default_keep_alive 60
+/// Default maximum number of RawPixelsStores of a pixel_store_pool.
+#define simpleomero_default_pixel_stores 8
+    /// \brief Several sessions to the same server, shared by the threads
+    ///        of a process.
+    /// \details Each session has its own client and Ice connection, so
+    ///          threads using different sessions do not serialize on a
+    ///          single connection. A timer pings every session each
+    ///          keep_alive seconds and reconnects the ones that expired.
+    class session_pool {
+        public:
+            /// \brief Constructor. Connects the sessions.
+            /*!
+            * \param host Server Address.
+            * \param port Port Number.
+            * \param user User Name.
+            * \param pass User Password.
+            * \param number_of_sessions number of sessions to keep.
+            * \param keep_alive seconds between pings of each session.
+            */
+            session_pool(
+                const std::string &host, const std::string &port,
+                const std::string &user, const std::string &pass,
+                const int &number_of_sessions,
+                const int &keep_alive = simpleomero_default_keep_alive
+            );
+            /// Destructor. Stops the pings and closes the sessions. Every
+            /// lease must have been returned.
+            ~session_pool();
+            /// Number of sessions connected.
+            int size();
+            /// \brief Leases the session with the fewest leases. A
+            ///        session can be leased to several threads at once.
+            /*!
+            * \return index of the session, to pass to get_session and
+            *         release; -1 if no session is connected.
+            */
+            int acquire();
+            /// \brief Returns a leased session.
+            /*!
+            * \param index index returned by acquire.
+            */
+            void release(const int &index);
+            /// Gets the session at index.
+            omero::api::ServiceFactoryPrx get_session(const int &index);
+            /// Gets every session, e.g. for omero2cv::image reader_sessions.
+            std::vector<omero::api::ServiceFactoryPrx> get_sessions();
+            /// Pings every session, reconnecting the ones that fail.
+            void keep_alive();
+        private:
+            std::string host;
+            std::string port;
+            std::string user;
+            std::string pass;
+            /// One connector per session.
+            std::vector<connector *> connectors;
+            /// Number of leases of each session.
+            std::vector<int> leases;
+            /// Connectors replaced by keep_alive, deleted with the pool.
+            std::vector<connector *> retired;
+            /// Runs keep_alive periodically.
+            IceUtil::TimerPtr timer;
+            /// Guards every member above.
+            IceUtil::Mutex mutex;
+    };
+
+    /// \brief Lease of a session_pool session, returned when the lease
+    ///        goes out of scope.
+    class session_lease {
+        public:
+            /// Leases the least used session of pool.
+            session_lease(session_pool &pool)
+            {
+                this->pool = &pool;
+                this->index = pool.acquire();
+            }
+            /// Returns the session.
+            ~session_lease()
+            {
+                if (this->index >= 0) {
+                    this->pool->release(this->index);
+                }
+            }
+            /// Leased session; a null proxy if the pool has none.
+            omero::api::ServiceFactoryPrx get_session()
+            {
+                if (this->index < 0) {
+                    return omero::api::ServiceFactoryPrx();
+                }
+                return this->pool->get_session(this->index);
+            }
+        private:
+            session_lease(const session_lease &);
+            session_lease &operator=(const session_lease &);
+            session_pool *pool;
+            int index;
+    };
+
+    /// \brief RawPixelsStores kept open across images and threads.
+    /// \details Opening a store costs a createRawPixelsStore and a
+    ///          setPixelsId round trip. Returned stores stay open: a store
+    ///          already set to the requested pixels is handed out without
+    ///          any server call, and once max_stores are open the least
+    ///          recently returned one is pointed to the new pixels.
+    class pixel_store_pool {
+        public:
+            /// Constructor.
+            /*!
+            * \param sessions sessions to create the stores in. Not owned.
+            * \param max_stores maximum number of stores open at once.
+            */
+            pixel_store_pool(
+                session_pool &sessions,
+                const int &max_stores = simpleomero_default_pixel_stores
+            );
+            /// Destructor. Closes the idle stores. Every store must have
+            /// been returned.
+            ~pixel_store_pool();
+            /// \brief Leases a store set to pixels_id, at full
+            ///        resolution. Blocks while max_stores are leased.
+            /// \details New stores are created in the session with the
+            ///          fewest stores, which stays leased for as long as
+            ///          the store is open.
+            /*!
+            * \param pixels_id OMERO pixels ID.
+            * \return store; a null proxy if it could not be opened.
+            */
+            omero::api::RawPixelsStorePrx acquire(const long long &pixels_id);
+            /// \brief Returns a leased store. Set it back to full
+            ///        resolution first if its level was changed.
+            /*!
+            * \param pixels_id OMERO pixels ID the store is set to.
+            * \param store store returned by acquire.
+            */
+            void release(
+                const long long &pixels_id,
+                const omero::api::RawPixelsStorePrx &store
+            );
+            /// \brief Returns a leased store that failed, closing it
+            ///        instead of keeping it for later leases.
+            /*!
+            * \param store store returned by acquire.
+            */
+            void discard(const omero::api::RawPixelsStorePrx &store);
+            /// Number of stores created.
+            long long created();
+            /// Number of leases served by a store already set to the
+            /// pixels.
+            long long reused();
+        private:
+            /// An open store.
+            struct pooled_store {
+                omero::api::RawPixelsStorePrx store;
+                long long pixels_id;
+                /// session_pool index of the session the store lives in.
+                int session;
+            };
+            /// Closes an open store and returns its session.
+            void close(const pooled_store &store);
+            session_pool *sessions;
+            int max_stores;
+            /// Number of stores leased.
+            int leased;
+            long long created_count;
+            long long reused_count;
+            /// Stores not leased, most recently returned first.
+            std::list<pooled_store> idle;
+            /// Stores leased.
+            std::list<pooled_store> in_use;
+            /// Guards every member above; acquire waits on it.
+            IceUtil::Monitor<IceUtil::Mutex> monitor;
+    };
+#endif //_simpleomero_session_pool_included_
+
 #ifndef _simpleomero_image_included_
 #define _simpleomero_image_included_ 
+/// Number of image ids per query of image::load_images.
+#define simpleomero_load_batch_size 500
     /// Simple image access
     class image {
         public:
@@ -125,6 +429,38 @@ namespace simple_omero {
                   const omero::api::ServiceFactoryPrx &session,
                   const int &image_id
             );
+            /// \brief   SimpleOMERO image contructor for an image already
+            ///          retrieved from OMERO.
+            /// \details No server round trip; the image's pixels, pixels
+            ///          type and update event must be loaded.
+            /*!
+             * \param loaded OMERO image with its primary pixels loaded.
+             */
+            image(const omero::model::ImagePtr &loaded);
+            /// \brief Retrieves many images with one query per
+            ///        simpleomero_load_batch_size images.
+            /// \details Opening images one by one costs a server round trip
+            ///          each; here the images, their pixels, pixels types
+            ///          and update events come back in the same queries.
+            /*!
+             * \param session pointer to curent session (Service Factory).
+             * \param image_ids Ids of the images to retrieve.
+             * \return images in the order of image_ids; ids not found are
+             *         skipped. The caller deletes them.
+             */
+            static std::vector<image *> load_images(
+                const omero::api::ServiceFactoryPrx &session,
+                const std::vector<int> &image_ids
+            );
+            /// \brief Reads update_event again from the server, e.g. after
+            ///        writing pixels.
+            /*!
+             * \param session pointer to curent session (Service Factory).
+             * \return update_event; -1 if it could not be read.
+             */
+            long long reload_update_event(
+                const omero::api::ServiceFactoryPrx &session
+            );
             /// \brief   SimpleOMERO image contructor for Creating image in
             ///          OMERO.
             /// \details Method creates NEW image in OMERO and then
@@ -154,6 +490,8 @@ namespace simple_omero {
                 const double &pixel_size_x, const double &pixel_size_y,
                 const double &pixel_size_z
             );
+            /// \brief Destructor. Deletes the pixel source, if any.
+            ~image();
             /// \brief Creates OMERO RawPixelStore for Reading/Writing pixels.
             /*! 
              * \param session pointer to curent session (Service Factory).
@@ -161,6 +499,52 @@ namespace simple_omero {
             void open_pixel_store(
                 const omero::api::ServiceFactoryPrx &session
             );
+            /// \brief Leases pixel_store from a pool instead of creating
+            ///        it. close_pixel_store returns it to the pool.
+            /*!
+             * \param pool pool to lease from. Not owned.
+             * \return 0 sucess; -1 Failed.
+             */
+            int open_pixel_store(pixel_store_pool &pool);
+            /// \brief Reads and writes the pixels through a local source,
+            ///        e.g. a file_pixel_source, instead of OMERO.
+            /// \details The image's metadata still comes from OMERO.
+            ///          pixel_store is left null, so the pipelines read
+            ///          and write synchronously through the source.
+            /*!
+             * \param source source of the image's pixels, deleted by
+             *        close_pixel_store.
+             * \return 0 sucess; -1 if source is NULL or not open, in which
+             *         case it is not taken over.
+             */
+            int open_pixel_source(pixel_source *source);
+            /// \brief Creates an additional OMERO RawPixelStore for this
+            ///        image, independent of image->pixel_store.
+            /*!
+             * \param session session to create the store in. It can be
+             *        a different session than the one the image was
+             *        retrieved with.
+             * \return RawPixelsStore set to this image's pixels. Close it
+             *         once done.
+             */
+            omero::api::RawPixelsStorePrx create_pixel_store(
+                const omero::api::ServiceFactoryPrx &session
+            );
+            /// \brief Gets the number of resolution levels of the pixels.
+            /*!
+             * \return number of levels; 1 if the pixels have no pyramid.
+             */
+            int get_resolution_levels();
+            /// \brief Sets the resolution level pixel_store and the stores
+            ///        created afterwards read at.
+            /// \details Levels go from 0, the smallest, to
+            ///          get_resolution_levels() - 1, full resolution.
+            ///          Updates resolution_level, level_size_x and
+            ///          level_size_y.
+            /*!
+             * \param level resolution level.
+             */
+            void set_resolution_level(const int &level);
             /// \brief Closes and saves OMERO RawPixelStore for Reading/Writing
             /// pixels.
             /*!
@@ -194,6 +578,7 @@ namespace simple_omero {
             /// Retrives Plane from previously opened image->pixel_store.
             /** Before using this method call image::open_pixel_store(session)
              *  once done retriving data call image::clse_pixel_store().
+             *  Pixels are returned in native byte order.
              */
             /*!
              * \param image_cast pre-allocated unsigned char buffer
@@ -207,9 +592,24 @@ namespace simple_omero {
                 unsigned char *image_cast, const int &plane,
                 const int &channel, const int &time_point, const int &bpp
             );
+            /// Copies raw plane bytes returned by the pixel store into
+            /// image_cast, converting from BIG_ENDIAN to native pixels
+            /// in a single pass if bpp > 1.
+            /*!
+             * \param bytes raw pixel bytes as returned by OMERO.
+             * \param image_cast pre-allocated unsigned char buffer
+             *        to store raw pixel bytes.
+             * \param size number of bytes to copy.
+             * \param bpp number of bytes per pixel.
+             */
+            static void copy_raw_pixels(
+                const std::vector<Ice::Byte> &bytes, unsigned char *image_cast,
+                const int &size, const int &bpp
+            );
             /// Retrives Hypercube from previously opened image->pixel_store.
             /** Before using this method call image::open_pixel_store(session)
              *  once done retriving data call image::clse_pixel_store().
+             *  Pixels are returned in native byte order.
              */
             /*!
              * \param image_cast pre-allocated unsigned char buffer to store
@@ -218,7 +618,8 @@ namespace simple_omero {
              * \param end_x last pixel.
              * \param start_y first row.
              * \param end_y last row.
-             * \param step_y step in y dimension.
+             * \param step_y step in y dimension; image_cast receives
+             *        (end_y - start_y + step_y - 1) / step_y rows.
              * \param start_z first plane.
              * \param end_z last plane.
              * \param bpp bytes per pixel.
@@ -229,9 +630,44 @@ namespace simple_omero {
                 const int &step_y, const int &start_z, const int &end_z,
                 const int &bpp
             );
+            /// Retrives strided 5D Hypercube from previously opened
+            /// image->pixel_store.
+            /** Before using this method call image::open_pixel_store(session)
+             *  once done retriving data call image::clse_pixel_store().
+             *  Pixels are returned in native byte order, x fastest, then
+             *  y, z, c and t.
+             */
+            /*!
+             * \param image_cast pre-allocated unsigned char buffer of
+             *        cube.count() * bpp bytes.
+             * \param cube region to retrive.
+             * \param bpp bytes per pixel.
+             */
+            void get_raw_pixels_hyper_cube(
+                unsigned char *image_cast, const hyper_cube &cube,
+                const int &bpp
+            );
+            /// \brief Retrives the raw BIG_ENDIAN bytes of a strided 5D
+            ///        Hypercube, for callers converting them themselves.
+            /// \details Throws std::out_of_range if the cube does not fit
+            ///          the image and std::length_error if the reply is
+            ///          short.
+            /*!
+             * \param cube region to retrive.
+             * \param bytes receives the bytes.
+             * \param bpp bytes per pixel.
+             */
+            void get_hyper_cube_bytes(
+                const hyper_cube &cube, std::vector<Ice::Byte> &bytes,
+                const int &bpp
+            );
+            /// \brief True if cube fits the image at the current
+            ///        resolution level, see hyper_cube::fits.
+            bool contains(const hyper_cube &cube);
             /// Retrives Row from previously opened image->pixel_store.
             /** Before using this method call image::open_pixel_store(session)
              *  once done retriving data call image::clse_pixel_store().
+             *  Pixels are returned in native byte order.
              */
             /*!
              * \param image_cast pre-allocated unsigned char buffer
@@ -246,22 +682,62 @@ namespace simple_omero {
                 unsigned char *image_cast, const int &row, const int &plane,
                 const int &channel, const int &time_point, const int &bpp
             );
+            /// Retrives Tile from previously opened image->pixel_store.
+            /** Before using this method call image::open_pixel_store(session)
+             *  once done retriving data call image::clse_pixel_store().
+             *  Pixels are returned in native byte order.
+             */
+            /*!
+             * \param image_cast pre-allocated unsigned char buffer
+             *        to store width * height raw pixels.
+             * \param plane z plane of interest.
+             * \param channel channel of interest.
+             * \param timepoint time point of interest.
+             * \param x first column of the tile.
+             * \param y first row of the tile.
+             * \param width tile width.
+             * \param height tile height.
+             * \param bpp number of bytes per pixel.
+             */
+            void get_raw_pixels_tile(
+                unsigned char *image_cast, const int &plane,
+                const int &channel, const int &time_point, const int &x,
+                const int &y, const int &width, const int &height,
+                const int &bpp
+            );
+            /// \brief Gets the tile size the server reads the pixels in.
+            /*!
+             * \param width tile width.
+             * \param height tile height.
+             */
+            void get_tile_size(int &width, int &height);
             /// Write pixels to OMERO image.
-            /** Converts unsigned char buffer to Ice::Byte vector and writes
-             *  it to specified time point, channel, plane.
+            /** Converts unsigned char buffer of native pixels to a
+             *  BIG_ENDIAN Ice::Byte vector and writes it to specified time
+             *  point, channel, plane.
              */
             /*!
-             * \param session session pointer to curent session
-             *        (Service Factory).
              * \param buffer buffer containing pixels to write.
+             * \param bpp number of bytes per pixel.
              * \param channel channel to write to.
              * \param timepoint timepoint to write to.
              * \param plane plane to write to.
              */
             void write_plane(
-                unsigned char *buffer, int bpp,
+                const unsigned char *buffer, int bpp,
                 const int &timepoint, const int &channel, const int &plane
             );
+            /// \brief Gets the largest block of pixels a single request
+            ///        to a store can carry, from Ice.MessageSizeMax less
+            ///        room for the protocol overhead.
+            /*!
+             * \param pixel_store RawPixelsStore the requests go to.
+             * \return maximum number of bytes of pixels; 0 to move plane
+             *         by plane.
+             */
+            static long long get_max_block_size(
+                const omero::api::RawPixelsStorePrx &pixel_store
+            );
             /// Pad integer to given number of digits.
             /** */
             /*!
@@ -292,14 +768,509 @@ namespace simple_omero {
             double size_y;
             /// OMERO image depth (number of z planes).
             double size_z;
+            /// Resolution level read at; -1 for full resolution.
+            int resolution_level;
+            /// Plane width at resolution_level.
+            int level_size_x;
+            /// Plane height at resolution_level.
+            int level_size_y;
             /// OMERO image ID
             int id;
+            /// OMERO pixels ID of the image's primary pixels.
+            long long pixels_id;
+            /// ID of the event that last updated the pixels; -1 if unknown.
+            long long update_event;
             /// Image name
             std::string name;
             /// Image description
             std::string description;
-            /// OMERO Raw Pixel Store for retrival of image data.
+            /// OMERO Raw Pixel Store for retrival of image data; null when
+            /// the pixels come from a local source.
             omero::api::RawPixelsStorePrx pixel_store;
+            /// Source the pixels are read from and written to; an
+            /// omero_pixel_source over pixel_store unless
+            /// open_pixel_source was used.
+            pixel_source *source;
+        private:
+            /// Not copyable, it owns source.
+            image(const image &);
+            image &operator=(const image &);
+            /// Pool pixel_store was leased from; NULL if it was created.
+            pixel_store_pool *store_pool;
+            /// Closes the store or source held, if any, even if closing
+            /// fails, so opening another does not leak it.
+            void release_pixel_store();
+            /// Sets up the data members from a retrieved image.
+            void set_up(const omero::model::ImagePtr &loaded);
     };
 #endif //_simpleomero_image_included
+
+#ifndef _simpleomero_request_queue_included_
+#define _simpleomero_request_queue_included_
+    /// \brief Asynchronous RawPixelsStore reads kept in flight in the
+    ///        order they are listed; shared by the prefetchers.
+    /// \details Request describes a single call and Index the position
+    ///          returned to the caller. Requests are issued until depth
+    ///          units are in flight, as counted by weight(), but one
+    ///          request is always sent. Derived classes issue and finish
+    ///          the calls; sources without a RawPixelsStore are read
+    ///          synchronously through next_local().
+    template <class Request, class Index>
+    class request_queue {
+        public:
+            virtual ~request_queue() {}
+        protected:
+            /// Issues the Ice call reading request.
+            virtual Ice::AsyncResultPtr begin(const Request &request) = 0;
+            /// Number of units read by request, counted against depth.
+            virtual size_t weight(const Request &request) {return 1;}
+            /// Sets up the queue and issues the first requests.
+            /*!
+             * \param indices positions returned to the caller, in order.
+             * \param requests calls reading them, in order.
+             * \param depth maximum number of units in flight.
+             */
+            void set_up(
+                const std::vector<Index> &indices,
+                const std::vector<Request> &requests, const int &depth)
+            {
+                this->indices = indices;
+                this->requests = requests;
+                this->next_request = 0;
+                this->depth = depth > 1 ? depth : 1;
+                this->in_flight_weight = 0;
+                this->fill();
+            }
+            /// Issues requests until depth units are in flight.
+            void fill()
+            {
+                // Local sources are read in next_local().
+                if (!this->pixel_store) {
+                    return;
+                }
+                while (this->next_request < this->requests.size() &&
+                       (this->in_flight.empty() || this->in_flight_weight +
+                        this->weight(this->requests.at(this->next_request))
+                        <= this->depth)) {
+                    const Request &request =
+                        this->requests.at(this->next_request);
+                    long long started = rpc_stats::now();
+                    this->in_flight.push_back(this->begin(request));
+                    // Only once the request is issued, so a begin_ that
+                    // throws does not put the two queues out of step.
+                    this->in_flight_started.push_back(started);
+                    this->in_flight_weight += this->weight(request);
+                    this->next_request++;
+                }
+            }
+            /// \brief Takes the oldest request in flight, issuing the
+            ///        following ones before the caller blocks on it.
+            /*!
+             * \param result pending call to finish.
+             * \param started rpc_stats::now() when it was sent.
+             * \param request request it was issued for.
+             * \return false if no request is left.
+             */
+            bool pop(
+                Ice::AsyncResultPtr &result, long long &started,
+                Request &request)
+            {
+                if (this->in_flight.empty()) {
+                    return false;
+                }
+                result = this->in_flight.front();
+                started = this->in_flight_started.front();
+                this->in_flight.pop_front();
+                this->in_flight_started.pop_front();
+                request = this->requests.at(
+                    this->next_request - this->in_flight.size() - 1
+                );
+                this->in_flight_weight -= this->weight(request);
+                this->fill();
+                return true;
+            }
+            /// Takes the next request when reading from a local source.
+            /// False if all have been read.
+            bool next_local(Request &request)
+            {
+                if (this->next_request >= this->requests.size()) {
+                    return false;
+                }
+                request = this->requests.at(this->next_request++);
+                return true;
+            }
+            /// OMERO Raw Pixel Store the pixels are read from.
+            omero::api::RawPixelsStorePrx pixel_store;
+            /// Local source the pixels are read from when pixel_store is
+            /// null. Not owned.
+            pixel_source *source;
+            /// Positions to read.
+            std::vector<Index> indices;
+            /// Requests reading them, in order.
+            std::vector<Request> requests;
+        private:
+            /// Position in requests of the next request to issue.
+            size_t next_request;
+            /// Maximum number of units in flight.
+            size_t depth;
+            /// Number of units of the requests in flight.
+            size_t in_flight_weight;
+            /// Requests in flight, oldest first.
+            std::deque<Ice::AsyncResultPtr> in_flight;
+            /// rpc_stats::now() when each request in flight was sent.
+            std::deque<long long> in_flight_started;
+    };
+#endif //_simpleomero_request_queue_included_
+
+#ifndef _simpleomero_plane_prefetcher_included_
+#define _simpleomero_plane_prefetcher_included_
+    /// Position of a single plane in an OMERO image.
+    struct plane_index {
+        /// z plane.
+        int plane;
+        /// Channel.
+        int channel;
+        /// Time point.
+        int time_point;
+    };
+
+    /// RawPixelsStore call moving a block of planes.
+    enum transfer_kind {
+        /// getPlane/setPlane, a single plane.
+        plane_transfer,
+        /// getStack/setStack, every z plane of a channel.
+        stack_transfer,
+        /// getTimepoint/setTimepoint, every plane of a time point.
+        timepoint_transfer
+    };
+
+    /// A run of planes moved by a single RawPixelsStore call.
+    struct plane_block {
+        /// Call moving the planes.
+        transfer_kind kind;
+        /// Position of the first plane in the plane list.
+        size_t first;
+        /// Number of planes.
+        size_t count;
+    };
+
+    /// \brief Reads a list of planes keeping several getPlane requests in
+    ///        flight.
+    /// \details Requests are issued with Ice asynchronous invocations so
+    ///          the planes following the one returned by next() are already
+    ///          in transit while the caller decodes it. Given the image's
+    ///          dimensions, runs of planes forming whole stacks or whole
+    ///          time points are read with a single getStack or
+    ///          getTimepoint, as long as the block fits in
+    ///          Ice.MessageSizeMax. At most depth planes are in flight,
+    ///          or a single block if it holds more.
+    class plane_prefetcher :
+        public request_queue<plane_block, plane_index> {
+        public:
+            /// Constructor. Issues the first depth requests.
+            /*!
+             * \param pixel_store opened RawPixelsStore to read from.
+             * \param planes planes to read, in the order they are returned.
+             * \param depth maximum number of planes in flight.
+             * \param size_z number of z planes of the image; 0 reads
+             *        plane by plane.
+             * \param size_c number of channels of the image.
+             * \param plane_size bytes per plane.
+             */
+            plane_prefetcher(
+                const omero::api::RawPixelsStorePrx &pixel_store,
+                const std::vector<plane_index> &planes, const int &depth,
+                const int &size_z = 0, const int &size_c = 0,
+                const long long &plane_size = 0
+            );
+            /// \brief Constructor reading from a pixel_source. Sources
+            ///        without a RawPixelsStore are read synchronously,
+            ///        plane by plane.
+            plane_prefetcher(
+                pixel_source *source,
+                const std::vector<plane_index> &planes, const int &depth,
+                const int &size_z = 0, const int &size_c = 0,
+                const long long &plane_size = 0
+            );
+            /// \brief Waits for the next plane and issues the next request.
+            /*!
+             * \param bytes raw pixel bytes of the plane as returned by OMERO.
+             * \param index position of the returned plane.
+             * \return true if a plane was returned; false if all planes
+             *         have been read.
+             */
+            bool next(std::vector<Ice::Byte> &bytes, plane_index &index);
+            /// \brief Waits for the next plane, without copying it out of
+            ///        a stack or time point.
+            /*!
+             * \param plane first raw pixel byte of the plane; valid until
+             *        the next call.
+             * \param plane_size number of bytes of the plane.
+             * \param index position of the returned plane.
+             * \return true if a plane was returned; false if all planes
+             *         have been read.
+             */
+            bool next(
+                const Ice::Byte *&plane, size_t &plane_size,
+                plane_index &index
+            );
+        protected:
+            /// Issues the getPlane, getStack or getTimepoint for block.
+            Ice::AsyncResultPtr begin(const plane_block &block);
+            /// Number of planes of block.
+            size_t weight(const plane_block &block);
+        private:
+            /// Makes sure current_block has a plane left to return,
+            /// waiting for the next block. False if all have been read.
+            bool receive();
+            /// Groups the planes into blocks; shared by the constructors.
+            void set_up(
+                const std::vector<plane_index> &planes, const int &depth,
+                const int &size_z, const int &size_c,
+                const long long &plane_size
+            );
+            /// Last plane, stack or time point received.
+            std::vector<Ice::Byte> block_bytes;
+            /// Block block_bytes was read by.
+            plane_block current_block;
+            /// Number of planes of current_block already returned.
+            size_t block_returned;
+    };
+#endif //_simpleomero_plane_prefetcher_included_
+
+#ifndef _simpleomero_tile_prefetcher_included_
+#define _simpleomero_tile_prefetcher_included_
+    /// Position and size of a single tile in an OMERO image.
+    struct tile_index {
+        /// z plane.
+        int plane;
+        /// Channel.
+        int channel;
+        /// Time point.
+        int time_point;
+        /// First column.
+        int x;
+        /// First row.
+        int y;
+        /// Tile width.
+        int width;
+        /// Tile height.
+        int height;
+    };
+
+    /// \brief Reads a list of tiles keeping several getTile requests in
+    ///        flight.
+    /// \details Same as plane_prefetcher, for tiles. Only the tiles in
+    ///          flight are held in memory.
+    class tile_prefetcher : public request_queue<tile_index, tile_index> {
+        public:
+            /// Constructor. Issues the first depth requests.
+            /*!
+             * \param pixel_store opened RawPixelsStore to read from.
+             * \param tiles tiles to read, in the order they are returned.
+             * \param depth maximum number of requests in flight.
+             */
+            tile_prefetcher(
+                const omero::api::RawPixelsStorePrx &pixel_store,
+                const std::vector<tile_index> &tiles, const int &depth
+            );
+            /// \brief Constructor reading from a pixel_source. Sources
+            ///        without a RawPixelsStore are read synchronously.
+            tile_prefetcher(
+                pixel_source *source, const std::vector<tile_index> &tiles,
+                const int &depth
+            );
+            /// \brief Waits for the next tile and issues the next request.
+            /*!
+             * \param bytes raw pixel bytes of the tile as returned by OMERO.
+             * \param index position of the returned tile.
+             * \return true if a tile was returned; false if all tiles
+             *         have been read.
+             */
+            bool next(std::vector<Ice::Byte> &bytes, tile_index &index);
+        protected:
+            /// Issues the getTile for tile.
+            Ice::AsyncResultPtr begin(const tile_index &tile);
+    };
+#endif //_simpleomero_tile_prefetcher_included_
+
+#ifndef _simpleomero_plane_writer_included_
+#define _simpleomero_plane_writer_included_
+/// Largest setStack/setTimepoint plane_writer sends, in bytes, well under
+/// the message size limit OMERO servers are usually configured with.
+#define simpleomero_max_upload_block (64LL << 20)
+    /// \brief Writes planes keeping several setPlane requests in flight.
+    /// \details Each plane is converted to BIG_ENDIAN in a reused buffer
+    ///          and sent with an Ice asynchronous invocation, so the next
+    ///          plane is converted while the previous ones are in transit.
+    ///          write() blocks only once depth requests are in flight.
+    ///          Given the image's dimensions, planes written in order from
+    ///          the first plane of a stack or time point are gathered and
+    ///          sent with a single setStack or setTimepoint, as long as the
+    ///          block fits in Ice.MessageSizeMax and
+    ///          simpleomero_max_upload_block.
+    class plane_writer {
+        public:
+            /// Constructor.
+            /*!
+             * \param pixel_store opened RawPixelsStore to write to.
+             * \param pixels_id OMERO pixels ID of the store, used to keep
+             *        plane_cache::shared in step.
+             * \param depth maximum number of requests in flight.
+             * \param size_z number of z planes of the image; 0 writes
+             *        plane by plane.
+             * \param size_c number of channels of the image.
+             */
+            plane_writer(
+                const omero::api::RawPixelsStorePrx &pixel_store,
+                const long long &pixels_id, const int &depth,
+                const int &size_z = 0, const int &size_c = 0
+            );
+            /// \brief Constructor writing to a pixel_source. Sources
+            ///        without a RawPixelsStore are written synchronously,
+            ///        plane by plane.
+            plane_writer(
+                pixel_source *source, const long long &pixels_id,
+                const int &depth, const int &size_z = 0,
+                const int &size_c = 0
+            );
+            /// Waits for the requests still in flight.
+            ~plane_writer();
+            /// \brief Converts a plane and issues its setPlane request.
+            /*!
+             * \param buffer native pixels of the plane; free to reuse once
+             *        write() returns.
+             * \param width plane width.
+             * \param height plane height.
+             * \param bpp number of bytes per pixel.
+             * \param index position of the plane.
+             */
+            void write(
+                const unsigned char *buffer, const int &width,
+                const int &height, const int &bpp, const plane_index &index
+            );
+            /// \brief Waits for every request in flight.
+            /*!
+             * \return planes that failed to be written since the last
+             *         flush(); empty on success.
+             */
+            std::vector<plane_index> flush();
+        private:
+            /// Not copyable, it owns the requests in flight.
+            plane_writer(const plane_writer &);
+            plane_writer &operator=(const plane_writer &);
+            /// Waits for the oldest request in flight.
+            void complete_oldest();
+            /// Issues a request writing bytes, once fewer than depth are
+            /// in flight.
+            void send(
+                const std::vector<Ice::Byte> &bytes,
+                const transfer_kind &kind,
+                const std::vector<plane_index> &planes
+            );
+            /// Sends the planes gathered so far one by one.
+            void send_pending();
+            /// True if index continues the block being gathered.
+            bool continues_block(const plane_index &index);
+            /// Sets up the writer; shared by the constructors.
+            void set_up(
+                const long long &pixels_id, const int &depth,
+                const int &size_z, const int &size_c
+            );
+            /// OMERO Raw Pixel Store the planes are written to.
+            omero::api::RawPixelsStorePrx pixel_store;
+            /// Local source the planes are written to when pixel_store is
+            /// null. Not owned.
+            pixel_source *source;
+            /// OMERO pixels ID of pixel_store.
+            long long pixels_id;
+            /// Maximum number of requests in flight.
+            size_t depth;
+            /// Number of z planes of the image; 0 writes plane by plane.
+            int size_z;
+            /// Number of channels of the image.
+            int size_c;
+            /// Largest block that can be sent, in bytes.
+            long long max_block_size;
+            /// BIG_ENDIAN bytes of the plane or block being sent. Ice
+            /// marshals the bytes when a request is issued, so it is reused.
+            std::vector<Ice::Byte> bytes;
+            /// Call the block being gathered will be sent with.
+            transfer_kind pending_kind;
+            /// Planes of the block being gathered, in bytes.
+            std::vector<plane_index> pending;
+            /// Bytes per plane of the block being gathered.
+            size_t pending_plane_size;
+            /// Number of planes the block being gathered needs.
+            size_t pending_count;
+            /// Requests in flight, oldest first.
+            std::deque<Ice::AsyncResultPtr> in_flight;
+            /// rpc_stats::now() when each request in flight was sent.
+            std::deque<long long> in_flight_started;
+            /// Call of each request in flight, oldest first.
+            std::deque<transfer_kind> in_flight_kinds;
+            /// Planes of the requests in flight, oldest first.
+            std::deque<std::vector<plane_index> > in_flight_planes;
+            /// Bytes sent by each request in flight, oldest first.
+            std::deque<long long> in_flight_bytes;
+            /// Planes that failed since the last flush().
+            std::vector<plane_index> failed;
+    };
+#endif //_simpleomero_plane_writer_included_
+
+#ifndef _simpleomero_plane_cache_included_
+#define _simpleomero_plane_cache_included_
+    /// \brief Interface of an in-memory cache of decoded planes.
+    /// \details If plane_cache::shared is set, image::get_raw_pixels
+    ///          looks planes up in it before asking the server and stores
+    ///          the planes it reads, and image::write_plane stores the
+    ///          planes it writes. Implementations must be thread safe.
+    class plane_cache {
+        public:
+            virtual ~plane_cache() {}
+            /// \brief Copies a cached plane into destination.
+            /*!
+             * \param pixels_id OMERO pixels ID.
+             * \param resolution_level resolution level; -1 for full
+             *        resolution.
+             * \param index position of the plane.
+             * \param destination buffer of width * height * bpp bytes.
+             * \param width plane width.
+             * \param height plane height.
+             * \param bpp number of bytes per pixel.
+             * \return true on a hit; false if the plane is not cached.
+             */
+            virtual bool fetch(
+                const long long &pixels_id, const int &resolution_level,
+                const plane_index &index,
+                unsigned char *destination, const int &width,
+                const int &height, const int &bpp
+            ) = 0;
+            /// \brief Stores a copy of a plane of native pixels.
+            /*!
+             * \param pixels_id OMERO pixels ID.
+             * \param resolution_level resolution level; -1 for full
+             *        resolution.
+             * \param index position of the plane.
+             * \param source width * height * bpp bytes of pixels.
+             * \param width plane width.
+             * \param height plane height.
+             * \param bpp number of bytes per pixel.
+             */
+            virtual void store(
+                const long long &pixels_id, const int &resolution_level,
+                const plane_index &index,
+                const unsigned char *source, const int &width,
+                const int &height, const int &bpp
+            ) = 0;
+            /// \brief Drops every plane of a pixels id.
+            /*!
+             * \param pixels_id OMERO pixels ID.
+             */
+            virtual void invalidate(const long long &pixels_id) = 0;
+            /// Cache shared by every image of the process; NULL (the
+            /// default) disables caching. Set it before reading.
+            static plane_cache *shared;
+    };
+#endif //_simpleomero_plane_cache_included_
 };
\ No newline at end of file
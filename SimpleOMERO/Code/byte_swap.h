@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace simple_omero
+{
+#ifndef _simpleomero_byte_swap_included_
+#define _simpleomero_byte_swap_included_
+    /// \brief Reverses the byte order of count elements of width bytes.
+    /// \details Converts between OMERO's BIG_ENDIAN pixels and native
+    ///          pixels in a single pass. Uses AVX2 or SSSE3 shuffles when
+    ///          the compiler targets them (SSE2 shifts for 2 byte elements)
+    ///          and plain byte moves for the remainder. source and
+    ///          destination may be the same buffer.
+    /*!
+     * \param source elements to convert.
+     * \param destination buffer receiving count * width bytes.
+     * \param count number of elements.
+     */
+    template <int width>
+    inline void byte_swap(
+        const unsigned char *source, unsigned char *destination,
+        const size_t &count)
+    {
+        const size_t bytes = count * width;
+        size_t i = 0;
+#if defined(__SSSE3__) || defined(__AVX2__)
+        // Shuffle indices reversing each element, repeated for each
+        // 128 bit lane.
+        unsigned char order[32];
+        for (int b = 0; b < 32; b++) {
+            order[b] = static_cast<unsigned char>(
+                (b % 16) / width * width + width - 1 - b % width
+            );
+        }
+#if defined(__AVX2__)
+        const __m256i order_256 =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(order));
+        for (; i + 32 <= bytes; i += 32) {
+            __m256i pixels = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(source + i)
+            );
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i *>(destination + i),
+                _mm256_shuffle_epi8(pixels, order_256)
+            );
+        }
+#endif
+        const __m128i order_128 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(order));
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i pixels = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(source + i)
+            );
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(destination + i),
+                _mm_shuffle_epi8(pixels, order_128)
+            );
+        }
+#elif defined(__SSE2__)
+        if (width == 2) {
+            for (; i + 16 <= bytes; i += 16) {
+                __m128i pixels = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(source + i)
+                );
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i *>(destination + i),
+                    _mm_or_si128(
+                        _mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8)
+                    )
+                );
+            }
+        }
+#endif
+        for (; i < bytes; i += width) {
+            for (int b = 0; b < width / 2; b++) {
+                unsigned char low = source[i + b];
+                unsigned char high = source[i + width - 1 - b];
+                destination[i + b] = high;
+                destination[i + width - 1 - b] = low;
+            }
+        }
+    }
+
+    /// Single byte elements only need copying.
+    template <>
+    inline void byte_swap<1>(
+        const unsigned char *source, unsigned char *destination,
+        const size_t &count)
+    {
+        if (source != destination) {
+            memcpy(destination, source, count);
+        }
+    }
+
+    /// \brief Reverses the byte order of count elements of width bytes.
+    /// \details Dispatches to byte_swap<width>. Widths other than 1, 2, 4
+    ///          and 8 are copied unchanged.
+    /*!
+     * \param source elements to convert.
+     * \param destination buffer receiving count * width bytes.
+     * \param count number of elements.
+     * \param width element width in bytes.
+     */
+    inline void byte_swap(
+        const unsigned char *source, unsigned char *destination,
+        const size_t &count, const int &width)
+    {
+        switch (width) {
+            case 2:
+                byte_swap<2>(source, destination, count);
+                break;
+            case 4:
+                byte_swap<4>(source, destination, count);
+                break;
+            case 8:
+                byte_swap<8>(source, destination, count);
+                break;
+            default:
+                byte_swap<1>(source, destination, count * width);
+                break;
+        }
+    }
+
+    /// A byte_swap<width> instantiation.
+    typedef void (*byte_swap_kernel)(
+        const unsigned char *, unsigned char *, const size_t &
+    );
+
+    /// \brief Gets the byte_swap<width> instantiation for a width, so
+    ///        loops over many planes of one type dispatch only once.
+    /*!
+     * \param width element width in bytes; 1, 2, 4 or 8.
+     * \return the kernel; byte_swap<1> (a copy) for other widths.
+     */
+    inline byte_swap_kernel get_byte_swap_kernel(const int &width)
+    {
+        switch (width) {
+            case 2:
+                return &byte_swap<2>;
+            case 4:
+                return &byte_swap<4>;
+            case 8:
+                return &byte_swap<8>;
+            default:
+                return &byte_swap<1>;
+        }
+    }
+#endif // _simpleomero_byte_swap_included_
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "logger.h"
+#include <stdlib.h>
+#include <IceUtil/Thread.h>
+#include <IceUtil/Time.h>
+
+
+namespace
+{
+    /// Background thread started by the first message; joined at exit.
+    IceUtil::ThreadControl *drain_control = NULL;
+}
+
+
+/// Prints the queued messages until logger::stop().
+class simple_omero::logger::drain_thread : public IceUtil::Thread
+{
+    public:
+        virtual void run()
+        {
+            while (!logger::stopping) {
+                if (logger::drain() == 0) {
+                    IceUtil::ThreadControl::sleep(
+                        IceUtil::Time::milliSeconds(10)
+                    );
+                }
+            }
+        }
+};
+
+
+int simple_omero::logger::threshold = simpleomero_log_info;
+simple_omero::logger::entry
+simple_omero::logger::entries[simpleomero_log_capacity];
+volatile long long simple_omero::logger::head = 0;
+volatile long long simple_omero::logger::tail = 0;
+volatile long long simple_omero::logger::dropped_count = 0;
+volatile int simple_omero::logger::started = 0;
+volatile int simple_omero::logger::stopping = 0;
+
+
+void simple_omero::logger::write(
+    const int &level, const std::string &message)
+{
+    if (stopping) {
+        return;
+    }
+    if (__sync_bool_compare_and_swap(&started, 0, 1)) {
+        IceUtil::ThreadPtr thread = new drain_thread();
+        drain_control = new IceUtil::ThreadControl(thread->start());
+        atexit(stop);
+    }
+    long long slot = head;
+    while (true) {
+        // Full: drop rather than wait on the console.
+        if (slot - tail >= simpleomero_log_capacity) {
+            __sync_fetch_and_add(&dropped_count, 1LL);
+            return;
+        }
+        long long seen = __sync_val_compare_and_swap(&head, slot, slot + 1);
+        if (seen == slot) {
+            break;
+        }
+        slot = seen;
+    }
+    entry &message_entry = entries[slot % simpleomero_log_capacity];
+    message_entry.level = level;
+    message_entry.time = time(NULL);
+    message_entry.message = message;
+    __sync_synchronize();
+    message_entry.ready = 1;
+}
+
+
+int simple_omero::logger::drain()
+{
+    // Single consumer: the drain thread, then stop() once it has joined
+    // it.
+    int printed = 0;
+    while (true) {
+        entry &message_entry = entries[tail % simpleomero_log_capacity];
+        if (!message_entry.ready) {
+            break;
+        }
+        __sync_synchronize();
+        std::cout << format_time(message_entry.time) << " "
+                  << message_entry.message << "\n";
+        message_entry.message.clear();
+        message_entry.ready = 0;
+        __sync_synchronize();
+        tail = tail + 1;
+        printed++;
+    }
+    if (printed > 0) {
+        std::cout.flush();
+    }
+    return printed;
+}
+
+
+void simple_omero::logger::flush()
+{
+    // Give up after a second without progress, e.g. if a thread died
+    // while writing its message.
+    long long last = tail;
+    for (int idle = 0; tail < head && idle < 1000; idle++) {
+        IceUtil::ThreadControl::sleep(IceUtil::Time::milliSeconds(1));
+        if (tail != last) {
+            last = tail;
+            idle = 0;
+        }
+    }
+}
+
+
+void simple_omero::logger::stop()
+{
+    stopping = 1;
+    __sync_synchronize();
+    if (drain_control != NULL) {
+        drain_control->join();
+        delete drain_control;
+        drain_control = NULL;
+    }
+    drain();
+}
+
+
+long long simple_omero::logger::dropped()
+{
+    return __sync_fetch_and_add(&dropped_count, 0LL);
+}
+
+
+std::string simple_omero::logger::format_time(const time_t &time)
+{
+    struct tm time_local;
+    char time_buffer[80];
+    localtime_r(&time, &time_local);
+    strftime(
+        time_buffer, sizeof(time_buffer), "(%Y-%m-%d.%X)", &time_local
+    );
+    return time_buffer;
+}
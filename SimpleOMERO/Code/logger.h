@@ -15,34 +15,116 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
-
-
 #include <stdio.h>
 #include <time.h>
 #include <iostream>
+#include <sstream>
+#include <string>
+
+
+/// Log levels, lowest first.
+#define simpleomero_log_debug   0
+#define simpleomero_log_info    1
+#define simpleomero_log_warning 2
+#define simpleomero_log_error   3
+#define simpleomero_log_off     4
+
+/// Messages below this level are compiled out of simpleomero_log. Build
+/// with -Dsimpleomero_log_compile_level=0 to keep the debug messages.
+#ifndef simpleomero_log_compile_level
+#define simpleomero_log_compile_level simpleomero_log_info
+#endif
+
+/// Number of messages the log buffer holds; further messages are dropped
+/// until the background thread catches up.
+#define simpleomero_log_capacity 4096
+
+/// True if messages of level are compiled in and above the run time level.
+#define simpleomero_log_on(level) \
+    ((level) >= simpleomero_log_compile_level && \
+     simple_omero::logger::enabled(level))
+
+/// \brief Queues a message, e.g.
+///        simpleomero_log(simpleomero_log_info, "Image " << id).
+/// \details The message is only formatted if its level is on, and written
+///          to std::cout by a background thread.
+#define simpleomero_log(level, message) \
+    do { \
+        if (simpleomero_log_on(level)) { \
+            std::ostringstream simpleomero_log_stream; \
+            simpleomero_log_stream << message; \
+            simple_omero::logger::write( \
+                level, simpleomero_log_stream.str() \
+            ); \
+        } \
+    } while (0)
 
 
 namespace simple_omero
 {
 #ifndef _utilities_logger_included_
 #define _utilities_logger_included_
+    /// \brief Asynchronous process wide log.
+    /// \details write() puts the message in a fixed size ring buffer with
+    ///          atomic operations only, no locks and no I/O; a background
+    ///          thread, started with the first message, prints the
+    ///          messages in order. At exit the thread is stopped and
+    ///          the pending messages are printed.
     class logger {
         public:
             const std::string date_time_now()
             {
-                time_t time_now;
-                struct tm * time_local;
-                char time_buffer[80];
-                
-                time(&time_now);
-                time_local = localtime(&time_now);
-                
-                strftime(
-                    time_buffer, sizeof(time_buffer),
-                    "(%Y-%m-%d.%X)", time_local
-                );
-                return time_buffer;
+                return format_time(time(NULL));
+            };
+            /// \brief Queues a message. Use simpleomero_log rather than
+            ///        calling it directly. Thread safe.
+            /*!
+             * \param level simpleomero_log_* level of the message.
+             * \param message message, without trailing new line.
+             */
+            static void write(const int &level, const std::string &message);
+            /// True if messages of level are printed at run time.
+            static bool enabled(const int &level)
+            {
+                return level >= threshold;
+            };
+            /// \brief Sets the run time level; simpleomero_log_off
+            ///        silences the log.
+            static void set_level(const int &level) {threshold = level;};
+            /// Waits until every queued message is printed.
+            static void flush();
+            /// Number of messages dropped because the buffer was full.
+            static long long dropped();
+        private:
+            /// A message in the ring buffer.
+            struct entry {
+                /// Set once the message is complete.
+                volatile int ready;
+                int level;
+                time_t time;
+                std::string message;
             };
+            class drain_thread;
+            friend class drain_thread;
+            static std::string format_time(const time_t &time);
+            /// Prints the messages queued so far. Returns the number
+            /// printed.
+            static int drain();
+            /// Stops the background thread, waits for it and prints the
+            /// messages left. Registered with atexit, so it runs before
+            /// entries is destroyed.
+            static void stop();
+            /// Run time level.
+            static int threshold;
+            static entry entries[simpleomero_log_capacity];
+            /// Number of messages reserved and printed.
+            static volatile long long head;
+            static volatile long long tail;
+            static volatile long long dropped_count;
+            /// Set once the background thread is started.
+            static volatile int started;
+            /// Set at exit; messages written after it are dropped.
+            static volatile int stopping;
     };
 #endif // _utilities_logger_included_
-}
\ No newline at end of file
+}
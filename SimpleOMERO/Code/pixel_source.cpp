@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "pixel_source.h"
+#include "byte_swap.h"
+#include "rpc_stats.h"
+#include "logger.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+
+
+simple_omero::pixel_source *simple_omero::pixel_source::require_open(
+    pixel_source *source)
+{
+    if (source == NULL || !source->is_open()) {
+        throw std::runtime_error("Pixel source not open");
+    }
+    return source;
+}
+
+
+simple_omero::omero_pixel_source::omero_pixel_source(
+    const omero::api::RawPixelsStorePrx &pixel_store)
+{
+    this->pixel_store = pixel_store;
+}
+
+
+void simple_omero::omero_pixel_source::get_plane(
+    const int &plane, const int &channel, const int &time_point,
+    std::vector<Ice::Byte> &bytes)
+{
+    rpc_timer timer(rpc_get_plane);
+    this->pixel_store->getPlane(plane, channel, time_point).swap(bytes);
+    timer.bytes = bytes.size();
+}
+
+
+void simple_omero::omero_pixel_source::get_row(
+    const int &row, const int &plane, const int &channel,
+    const int &time_point, std::vector<Ice::Byte> &bytes)
+{
+    rpc_timer timer(rpc_get_row);
+    this->pixel_store->getRow(row, plane, channel, time_point).swap(bytes);
+    timer.bytes = bytes.size();
+}
+
+
+void simple_omero::omero_pixel_source::get_tile(
+    const int &plane, const int &channel, const int &time_point,
+    const int &x, const int &y, const int &width, const int &height,
+    std::vector<Ice::Byte> &bytes)
+{
+    rpc_timer timer(rpc_get_tile);
+    this->pixel_store->getTile(
+        plane, channel, time_point, x, y, width, height
+    ).swap(bytes);
+    timer.bytes = bytes.size();
+}
+
+
+void simple_omero::omero_pixel_source::get_hyper_cube(
+    const int offset[5], const int size[5], const int step[5],
+    std::vector<Ice::Byte> &bytes)
+{
+    omero::sys::IntList offset_list(offset, offset + 5);
+    omero::sys::IntList size_list(size, size + 5);
+    omero::sys::IntList step_list(step, step + 5);
+    // The server subsamples, so steps > 1 move fewer bytes.
+    rpc_timer timer(rpc_get_hypercube);
+    this->pixel_store->getHypercube(offset_list, size_list, step_list)
+        .swap(bytes);
+    timer.bytes = bytes.size();
+}
+
+
+void simple_omero::omero_pixel_source::get_tile_size(int &width, int &height)
+{
+    Ice::IntSeq tile_size = this->pixel_store->getTileSize();
+    width = tile_size.at(0);
+    height = tile_size.at(1);
+}
+
+
+void simple_omero::omero_pixel_source::set_plane(
+    const std::vector<Ice::Byte> &bytes, const int &plane,
+    const int &channel, const int &time_point)
+{
+    rpc_timer timer(rpc_set_plane, bytes.size());
+    this->pixel_store->setPlane(bytes, plane, channel, time_point);
+}
+
+
+void simple_omero::omero_pixel_source::save()
+{
+    this->pixel_store->save();
+}
+
+
+void simple_omero::omero_pixel_source::close()
+{
+    this->pixel_store->close();
+}
+
+
+omero::api::RawPixelsStorePrx
+simple_omero::omero_pixel_source::get_pixel_store()
+{
+    return this->pixel_store;
+}
+
+
+bool simple_omero::omero_pixel_source::is_open()
+{
+    return this->pixel_store;
+}
+
+
+simple_omero::file_pixel_source::file_pixel_source(
+    const std::string &path, const int &size_x, const int &size_y,
+    const int &size_z, const int &number_of_channels,
+    const int &number_of_timepoints, const int &bpp, const bool &big_endian,
+    const bool &writable)
+{
+    this->dimensions[0] = size_x;
+    this->dimensions[1] = size_y;
+    this->dimensions[2] = size_z;
+    this->dimensions[3] = number_of_channels;
+    this->dimensions[4] = number_of_timepoints;
+    this->bpp = bpp;
+    this->big_endian = big_endian;
+    this->writable = writable;
+    this->data = NULL;
+    this->size = bpp;
+    for (int d = 0; d < 5; d++) {
+        this->size *= this->dimensions[d];
+    }
+    this->file = ::open(
+        path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644
+    );
+    if (this->file < 0) {
+        simpleomero_log(simpleomero_log_error,
+            "Cannot open pixels file " << path << "!!!!"
+        );
+        return;
+    }
+    struct stat status;
+    bool sized = fstat(this->file, &status) == 0;
+    if (sized && status.st_size < this->size && writable) {
+        sized = ftruncate(this->file, this->size) == 0;
+    } else if (sized && status.st_size < this->size) {
+        sized = false;
+    }
+    void *mapped = MAP_FAILED;
+    if (sized) {
+        mapped = mmap(
+            NULL, this->size,
+            writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+            this->file, 0
+        );
+    }
+    if (mapped == MAP_FAILED) {
+        simpleomero_log(simpleomero_log_error,
+            "Cannot map " << this->size << " bytes of pixels file "
+            << path << "!!!!"
+        );
+        this->close();
+        return;
+    }
+    this->data = static_cast<unsigned char *>(mapped);
+    // Planes are mostly read in order.
+    madvise(this->data, this->size, MADV_SEQUENTIAL);
+}
+
+
+simple_omero::file_pixel_source::~file_pixel_source()
+{
+    this->close();
+}
+
+
+bool simple_omero::file_pixel_source::is_open()
+{
+    return this->data != NULL;
+}
+
+
+std::string simple_omero::file_pixel_source::repository_path(
+    const std::string &repository, const long long &pixels_id)
+{
+    std::string directories;
+    long long remaining = pixels_id;
+    while (remaining > 999) {
+        remaining /= 1000;
+        std::ostringstream directory;
+        directory << "Dir-" << std::setw(3) << std::setfill('0')
+                  << remaining % 1000 << "/";
+        directories = directory.str() + directories;
+    }
+    std::ostringstream path;
+    path << repository << "/Pixels/" << directories << pixels_id;
+    return path.str();
+}
+
+
+long long simple_omero::file_pixel_source::offset_of(
+    const int &x, const int &y, const int &plane, const int &channel,
+    const int &time_point)
+{
+    if (!this->is_open()) {
+        throw std::runtime_error("Pixels file not open");
+    }
+    int position[5] = {x, y, plane, channel, time_point};
+    long long offset = 0;
+    for (int d = 4; d >= 0; d--) {
+        if (position[d] < 0 || position[d] >= this->dimensions[d]) {
+            throw std::out_of_range("Pixel outside the image");
+        }
+        offset = offset * this->dimensions[d] + position[d];
+    }
+    return offset * this->bpp;
+}
+
+
+void simple_omero::file_pixel_source::copy_out(
+    const long long &offset, const long long &count, Ice::Byte *destination)
+{
+    if (this->big_endian) {
+        memcpy(destination, this->data + offset, count * this->bpp);
+    } else {
+        // Swapping either way is the same conversion.
+        byte_swap(this->data + offset, destination, count, this->bpp);
+    }
+}
+
+
+void simple_omero::file_pixel_source::get_plane(
+    const int &plane, const int &channel, const int &time_point,
+    std::vector<Ice::Byte> &bytes)
+{
+    long long pixels = (long long) this->dimensions[0] * this->dimensions[1];
+    bytes.resize(pixels * this->bpp);
+    this->copy_out(
+        this->offset_of(0, 0, plane, channel, time_point), pixels, &bytes[0]
+    );
+}
+
+
+void simple_omero::file_pixel_source::get_row(
+    const int &row, const int &plane, const int &channel,
+    const int &time_point, std::vector<Ice::Byte> &bytes)
+{
+    bytes.resize(this->dimensions[0] * this->bpp);
+    this->copy_out(
+        this->offset_of(0, row, plane, channel, time_point),
+        this->dimensions[0], &bytes[0]
+    );
+}
+
+
+void simple_omero::file_pixel_source::get_tile(
+    const int &plane, const int &channel, const int &time_point,
+    const int &x, const int &y, const int &width, const int &height,
+    std::vector<Ice::Byte> &bytes)
+{
+    if (width <= 0 || height <= 0) {
+        throw std::out_of_range("Empty tile");
+    }
+    // Checks the last pixel of the tile lies in the image.
+    this->offset_of(x + width - 1, y + height - 1, plane, channel, time_point);
+    long long row_size = (long long) width * this->bpp;
+    bytes.resize(row_size * height);
+    for (int row = 0; row < height; row++) {
+        this->copy_out(
+            this->offset_of(x, y + row, plane, channel, time_point), width,
+            &bytes[row * row_size]
+        );
+    }
+}
+
+
+void simple_omero::file_pixel_source::get_hyper_cube(
+    const int offset[5], const int size[5], const int step[5],
+    std::vector<Ice::Byte> &bytes)
+{
+    int extent[5];
+    long long count = 1;
+    for (int d = 0; d < 5; d++) {
+        if (size[d] <= 0 || step[d] <= 0 ||
+            offset[d] + size[d] > this->dimensions[d]) {
+            throw std::out_of_range("Hypercube outside the image");
+        }
+        extent[d] = (size[d] + step[d] - 1) / step[d];
+        count *= extent[d];
+    }
+    bytes.resize(count * this->bpp);
+    Ice::Byte *destination = bytes.empty() ? NULL : &bytes[0];
+    for (int t = 0; t < extent[4]; t++) {
+        for (int c = 0; c < extent[3]; c++) {
+            for (int z = 0; z < extent[2]; z++) {
+                for (int y = 0; y < extent[1]; y++) {
+                    long long row = this->offset_of(
+                        offset[0], offset[1] + y * step[1],
+                        offset[2] + z * step[2], offset[3] + c * step[3],
+                        offset[4] + t * step[4]
+                    );
+                    if (step[0] == 1) {
+                        this->copy_out(row, extent[0], destination);
+                        destination += extent[0] * this->bpp;
+                        continue;
+                    }
+                    for (int x = 0; x < extent[0]; x++) {
+                        this->copy_out(
+                            row + (long long) x * step[0] * this->bpp, 1,
+                            destination
+                        );
+                        destination += this->bpp;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void simple_omero::file_pixel_source::get_tile_size(int &width, int &height)
+{
+    // Whole rows keep the reads sequential in the file.
+    width = this->dimensions[0];
+    height = std::min(this->dimensions[1], 256);
+}
+
+
+void simple_omero::file_pixel_source::set_plane(
+    const std::vector<Ice::Byte> &bytes, const int &plane,
+    const int &channel, const int &time_point)
+{
+    long long pixels = (long long) this->dimensions[0] * this->dimensions[1];
+    if (!this->writable || (long long) bytes.size() != pixels * this->bpp) {
+        throw std::invalid_argument("Plane not writable");
+    }
+    unsigned char *destination =
+        this->data + this->offset_of(0, 0, plane, channel, time_point);
+    if (this->big_endian) {
+        memcpy(destination, &bytes[0], bytes.size());
+    } else {
+        byte_swap(&bytes[0], destination, pixels, this->bpp);
+    }
+}
+
+
+void simple_omero::file_pixel_source::save()
+{
+    if (this->data != NULL && this->writable) {
+        msync(this->data, this->size, MS_SYNC);
+    }
+}
+
+
+void simple_omero::file_pixel_source::close()
+{
+    if (this->data != NULL) {
+        munmap(this->data, this->size);
+        this->data = NULL;
+    }
+    if (this->file >= 0) {
+        ::close(this->file);
+        this->file = -1;
+    }
+}
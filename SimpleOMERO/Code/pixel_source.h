@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <string>
+#include <vector>
+#include "SimpleOMERO_Headers.h"
+
+
+namespace simple_omero
+{
+#ifndef _simpleomero_pixel_source_included_
+#define _simpleomero_pixel_source_included_
+    /// \brief Where the pixels of an image are read from and written to.
+    /// \details Pixels travel as BIG_ENDIAN bytes, as OMERO sends them,
+    ///          so every source is decoded the same way. Planes are
+    ///          addressed as in RawPixelsStore. Failures are reported with
+    ///          exceptions, as the Ice calls do.
+    class pixel_source {
+        public:
+            /// Destructor. Does not close the source.
+            virtual ~pixel_source() {}
+            /// Reads a plane.
+            virtual void get_plane(
+                const int &plane, const int &channel, const int &time_point,
+                std::vector<Ice::Byte> &bytes
+            ) = 0;
+            /// Reads a row of a plane.
+            virtual void get_row(
+                const int &row, const int &plane, const int &channel,
+                const int &time_point, std::vector<Ice::Byte> &bytes
+            ) = 0;
+            /// Reads a tile of a plane.
+            virtual void get_tile(
+                const int &plane, const int &channel, const int &time_point,
+                const int &x, const int &y, const int &width,
+                const int &height, std::vector<Ice::Byte> &bytes
+            ) = 0;
+            /// Reads a strided 5D region, dimensions in XYZCT order, x
+            /// fastest in the result.
+            virtual void get_hyper_cube(
+                const int offset[5], const int size[5], const int step[5],
+                std::vector<Ice::Byte> &bytes
+            ) = 0;
+            /// Gets the tile size the pixels are best read in.
+            virtual void get_tile_size(int &width, int &height) = 0;
+            /// Writes a plane.
+            virtual void set_plane(
+                const std::vector<Ice::Byte> &bytes, const int &plane,
+                const int &channel, const int &time_point
+            ) = 0;
+            /// Makes the planes written so far durable.
+            virtual void save() = 0;
+            /// Releases the source; no call may follow.
+            virtual void close() = 0;
+            /// True if the source can be read; sources that failed to
+            /// open throw from every read and write.
+            virtual bool is_open() {return true;}
+            /// \brief Checks that a source can be used, e.g. that the
+            ///        image holding it has not been closed.
+            /*!
+             * \param source source to check; may be NULL.
+             * \return source; throws std::runtime_error if it is NULL or
+             *         not open.
+             */
+            static pixel_source *require_open(pixel_source *source);
+            /// \brief Gets the RawPixelsStore behind the source, which
+            ///        plane_prefetcher, tile_prefetcher and plane_writer
+            ///        keep several requests in flight on.
+            /*!
+             * \return the store; a null proxy for local sources, which are
+             *         read and written synchronously.
+             */
+            virtual omero::api::RawPixelsStorePrx get_pixel_store()
+            {
+                return omero::api::RawPixelsStorePrx();
+            }
+    };
+
+    /// \brief Pixels of an OMERO RawPixelsStore.
+    class omero_pixel_source : public pixel_source {
+        public:
+            /// Constructor.
+            /*!
+             * \param pixel_store RawPixelsStore set to the image's pixels.
+             */
+            omero_pixel_source(
+                const omero::api::RawPixelsStorePrx &pixel_store
+            );
+            virtual void get_plane(
+                const int &plane, const int &channel, const int &time_point,
+                std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_row(
+                const int &row, const int &plane, const int &channel,
+                const int &time_point, std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_tile(
+                const int &plane, const int &channel, const int &time_point,
+                const int &x, const int &y, const int &width,
+                const int &height, std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_hyper_cube(
+                const int offset[5], const int size[5], const int step[5],
+                std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_tile_size(int &width, int &height);
+            virtual void set_plane(
+                const std::vector<Ice::Byte> &bytes, const int &plane,
+                const int &channel, const int &time_point
+            );
+            virtual void save();
+            virtual void close();
+            virtual bool is_open();
+            virtual omero::api::RawPixelsStorePrx get_pixel_store();
+        private:
+            /// OMERO Raw Pixel Store.
+            omero::api::RawPixelsStorePrx pixel_store;
+    };
+
+    /// \brief Pixels of a local raw file, mapped into memory.
+    /// \details The file holds the planes one after the other without
+    ///          headers, x fastest, then y, z, c and t, as OMERO stores
+    ///          pixels in its binary repository. Reads copy straight from
+    ///          the page cache, so jobs running next to the data skip Ice
+    ///          and the network.
+    class file_pixel_source : public pixel_source {
+        public:
+            /// Constructor. Maps the file; check is_open().
+            /*!
+             * \param path raw file.
+             * \param size_x plane width.
+             * \param size_y plane height.
+             * \param size_z number of planes.
+             * \param number_of_channels number of channels.
+             * \param number_of_timepoints number of time points.
+             * \param bpp bytes per pixel.
+             * \param big_endian byte order of the file.
+             * \param writable open for writing, creating the file or
+             *        extending it to the image's size if needed.
+             */
+            file_pixel_source(
+                const std::string &path, const int &size_x,
+                const int &size_y, const int &size_z,
+                const int &number_of_channels,
+                const int &number_of_timepoints, const int &bpp,
+                const bool &big_endian = true, const bool &writable = false
+            );
+            /// Destructor. Unmaps the file.
+            virtual ~file_pixel_source();
+            /// True if the file is mapped.
+            virtual bool is_open();
+            /// \brief Path of a pixels file in an OMERO binary repository.
+            /*!
+             * \param repository repository root, e.g. "/OMERO".
+             * \param pixels_id OMERO pixels ID.
+             * \return path of the file, nested in Dir-xxx directories as
+             *         the server does for IDs above 999.
+             */
+            static std::string repository_path(
+                const std::string &repository, const long long &pixels_id
+            );
+            virtual void get_plane(
+                const int &plane, const int &channel, const int &time_point,
+                std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_row(
+                const int &row, const int &plane, const int &channel,
+                const int &time_point, std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_tile(
+                const int &plane, const int &channel, const int &time_point,
+                const int &x, const int &y, const int &width,
+                const int &height, std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_hyper_cube(
+                const int offset[5], const int size[5], const int step[5],
+                std::vector<Ice::Byte> &bytes
+            );
+            virtual void get_tile_size(int &width, int &height);
+            virtual void set_plane(
+                const std::vector<Ice::Byte> &bytes, const int &plane,
+                const int &channel, const int &time_point
+            );
+            virtual void save();
+            virtual void close();
+        private:
+            /// Offset of a pixel in the file; throws std::out_of_range if
+            /// it lies outside the image and std::runtime_error if the
+            /// file is not mapped. Every read and write goes through it.
+            long long offset_of(
+                const int &x, const int &y, const int &plane,
+                const int &channel, const int &time_point
+            );
+            /// Copies count pixels from the file, converting them to
+            /// BIG_ENDIAN if needed.
+            void copy_out(
+                const long long &offset, const long long &count,
+                Ice::Byte *destination
+            );
+            /// Image dimensions, XYZCT.
+            int dimensions[5];
+            /// Bytes per pixel.
+            int bpp;
+            /// Byte order of the file.
+            bool big_endian;
+            /// True if mapped for writing.
+            bool writable;
+            /// File descriptor; -1 if not open.
+            int file;
+            /// Mapped file; NULL if not open.
+            unsigned char *data;
+            /// Size of the mapping.
+            long long size;
+    };
+#endif //_simpleomero_pixel_source_included_
+}
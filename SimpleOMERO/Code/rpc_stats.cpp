@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "rpc_stats.h"
+#include <string.h>
+#include <sstream>
+
+
+const char *const simple_omero::rpc_stats::names[rpc_number_of_operations] = {
+    "getPlane",
+    "getStack",
+    "getTimepoint",
+    "getRow",
+    "getTile",
+    "getHypercube",
+    "setPlane",
+    "setStack",
+    "setTimepoint",
+    "getPlaneSize",
+    "getRowSize",
+    "setPixelsId",
+    "decode",
+    "copy"
+};
+
+
+bool simple_omero::rpc_stats::enabled = true;
+
+
+simple_omero::rpc_counters
+simple_omero::rpc_stats::counters[rpc_number_of_operations];
+
+
+void simple_omero::rpc_stats::record(
+    const rpc_operation &operation, const long long &microseconds,
+    const long long &bytes, const bool &failed)
+{
+    rpc_counters &counter = counters[operation];
+    int bucket = 0;
+    for (long long t = microseconds >> 1;
+         t > 0 && bucket < simpleomero_latency_buckets - 1; t >>= 1) {
+        bucket++;
+    }
+    __sync_fetch_and_add(&counter.calls, 1LL);
+    __sync_fetch_and_add(&counter.bytes, bytes);
+    __sync_fetch_and_add(&counter.total_us, microseconds);
+    __sync_fetch_and_add(&counter.histogram[bucket], 1LL);
+    if (failed) {
+        __sync_fetch_and_add(&counter.errors, 1LL);
+    }
+    long long longest = counter.max_us;
+    while (microseconds > longest) {
+        long long seen = __sync_val_compare_and_swap(
+            &counter.max_us, longest, microseconds
+        );
+        if (seen == longest) {
+            break;
+        }
+        longest = seen;
+    }
+}
+
+
+simple_omero::rpc_counters simple_omero::rpc_stats::get(
+    const rpc_operation &operation)
+{
+    // Each field is read atomically; the snapshot as a whole is not.
+    rpc_counters &counter = counters[operation];
+    rpc_counters snapshot;
+    snapshot.calls = __sync_fetch_and_add(&counter.calls, 0LL);
+    snapshot.errors = __sync_fetch_and_add(&counter.errors, 0LL);
+    snapshot.bytes = __sync_fetch_and_add(&counter.bytes, 0LL);
+    snapshot.total_us = __sync_fetch_and_add(&counter.total_us, 0LL);
+    snapshot.max_us = __sync_fetch_and_add(&counter.max_us, 0LL);
+    for (int b = 0; b < simpleomero_latency_buckets; b++) {
+        snapshot.histogram[b] =
+            __sync_fetch_and_add(&counter.histogram[b], 0LL);
+    }
+    return snapshot;
+}
+
+
+void simple_omero::rpc_stats::reset()
+{
+    memset(counters, 0, sizeof(counters));
+    __sync_synchronize();
+}
+
+
+std::string simple_omero::rpc_stats::to_json()
+{
+    std::ostringstream json;
+    json << "{";
+    for (int i = 0; i < rpc_number_of_operations; i++) {
+        rpc_counters counter = get(static_cast<rpc_operation>(i));
+        json << (i > 0 ? "," : "") << "\"" << names[i] << "\":{"
+             << "\"calls\":" << counter.calls
+             << ",\"errors\":" << counter.errors
+             << ",\"bytes\":" << counter.bytes
+             << ",\"total_us\":" << counter.total_us
+             << ",\"max_us\":" << counter.max_us
+             << ",\"histogram\":[";
+        for (int b = 0; b < simpleomero_latency_buckets; b++) {
+            json << (b > 0 ? "," : "") << counter.histogram[b];
+        }
+        json << "]}";
+    }
+    json << "}";
+    return json.str();
+}
+
+
+std::string simple_omero::rpc_stats::to_prometheus()
+{
+    rpc_counters snapshot[rpc_number_of_operations];
+    for (int i = 0; i < rpc_number_of_operations; i++) {
+        snapshot[i] = get(static_cast<rpc_operation>(i));
+    }
+    std::ostringstream text;
+    const char *totals[] = {"calls", "errors", "bytes"};
+    for (int m = 0; m < 3; m++) {
+        text << "# TYPE simple_omero_" << totals[m] << "_total counter\n";
+        for (int i = 0; i < rpc_number_of_operations; i++) {
+            long long value = m == 0 ? snapshot[i].calls :
+                m == 1 ? snapshot[i].errors : snapshot[i].bytes;
+            text << "simple_omero_" << totals[m] << "_total{operation=\""
+                 << names[i] << "\"} " << value << "\n";
+        }
+    }
+    text << "# TYPE simple_omero_latency_seconds histogram\n";
+    for (int i = 0; i < rpc_number_of_operations; i++) {
+        long long cumulative = 0;
+        for (int b = 0; b < simpleomero_latency_buckets - 1; b++) {
+            cumulative += snapshot[i].histogram[b];
+            text << "simple_omero_latency_seconds_bucket{operation=\""
+                 << names[i] << "\",le=\"" << (2LL << b) / 1e6 << "\"} "
+                 << cumulative << "\n";
+        }
+        cumulative += snapshot[i].histogram[simpleomero_latency_buckets - 1];
+        text << "simple_omero_latency_seconds_bucket{operation=\""
+             << names[i] << "\",le=\"+Inf\"} " << cumulative << "\n";
+        text << "simple_omero_latency_seconds_sum{operation=\""
+             << names[i] << "\"} " << snapshot[i].total_us / 1e6 << "\n";
+        text << "simple_omero_latency_seconds_count{operation=\""
+             << names[i] << "\"} " << cumulative << "\n";
+    }
+    return text.str();
+}
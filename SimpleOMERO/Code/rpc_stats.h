@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) Copyright 2014 Glencoe Software, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <string>
+#include <exception>
+#include <IceUtil/Time.h>
+
+
+/// Number of latency histogram buckets; bucket i counts latencies below
+/// 2^(i + 1) microseconds, the last one everything longer.
+#define simpleomero_latency_buckets 32
+
+
+namespace simple_omero
+{
+#ifndef _simpleomero_rpc_stats_included_
+#define _simpleomero_rpc_stats_included_
+    /// Operations counted by rpc_stats.
+    enum rpc_operation {
+        rpc_get_plane,
+        rpc_get_stack,
+        rpc_get_timepoint,
+        rpc_get_row,
+        rpc_get_tile,
+        rpc_get_hypercube,
+        rpc_set_plane,
+        rpc_set_stack,
+        rpc_set_timepoint,
+        rpc_get_plane_size,
+        rpc_get_row_size,
+        rpc_set_pixels_id,
+        /// Byte order conversion of pixels, not a server call.
+        rpc_decode,
+        /// Copies of planes out of stacks and time points, not a server
+        /// call.
+        rpc_copy,
+        /// Number of operations.
+        rpc_number_of_operations
+    };
+
+    /// Counters of one operation.
+    struct rpc_counters {
+        long long calls;
+        /// Calls that threw.
+        long long errors;
+        /// Pixel bytes moved.
+        long long bytes;
+        /// Sum of latencies in microseconds.
+        long long total_us;
+        /// Longest latency in microseconds.
+        long long max_us;
+        /// Calls by latency, see simpleomero_latency_buckets.
+        long long histogram[simpleomero_latency_buckets];
+    };
+
+    /// \brief Process wide counters and latency histograms of the
+    ///        RawPixelsStore calls and pixel conversions simple_omero makes.
+    /// \details Recording is lock free (atomic adds) and costs two clock
+    ///          reads per call; set enabled to false to skip even those.
+    class rpc_stats {
+        public:
+            /// \brief Records one operation. Thread safe.
+            /*!
+             * \param operation operation performed.
+             * \param microseconds time it took.
+             * \param bytes pixel bytes moved.
+             * \param failed true if it threw.
+             */
+            static void record(
+                const rpc_operation &operation,
+                const long long &microseconds, const long long &bytes,
+                const bool &failed
+            );
+            /// \brief Gets a snapshot of the counters of an operation.
+            /*!
+             * \param operation operation to get.
+             */
+            static rpc_counters get(const rpc_operation &operation);
+            /// Zeroes every counter.
+            static void reset();
+            /// \brief Dumps every counter as a JSON object keyed by
+            ///        operation name.
+            static std::string to_json();
+            /// \brief Dumps every counter in the Prometheus text
+            ///        exposition format.
+            static std::string to_prometheus();
+            /// Monotonic clock in microseconds.
+            static long long now()
+            {
+                return IceUtil::Time::now(IceUtil::Time::Monotonic)
+                    .toMicroSeconds();
+            };
+            /// Name of each operation, as in the RawPixelsStore interface.
+            static const char *const names[rpc_number_of_operations];
+            /// Set to false to stop recording. true by default.
+            static bool enabled;
+        private:
+            static rpc_counters counters[rpc_number_of_operations];
+    };
+
+    /// \brief Records the operation of its scope when it goes out of it.
+    /// \details An operation left through an exception, or marked failed,
+    ///          is counted as an error.
+    class rpc_timer {
+        public:
+            /// Starts timing.
+            /*!
+             * \param operation operation performed in the scope.
+             * \param bytes pixel bytes moved, if known beforehand.
+             */
+            rpc_timer(
+                const rpc_operation &operation, const long long &bytes = 0)
+            {
+                this->operation = operation;
+                this->bytes = bytes;
+                this->failed = false;
+                this->start = rpc_stats::enabled ? rpc_stats::now() : 0;
+            };
+            /// Records the operation.
+            ~rpc_timer()
+            {
+                if (rpc_stats::enabled) {
+                    rpc_stats::record(
+                        this->operation, rpc_stats::now() - this->start,
+                        this->bytes,
+                        this->failed || std::uncaught_exception()
+                    );
+                }
+            };
+            /// Pixel bytes moved; set it once known.
+            long long bytes;
+            /// Start time, rpc_stats::now(); set it to time an asynchronous
+            /// call from when it was sent.
+            long long start;
+            /// Set to true to count an operation whose exception was
+            /// caught in the scope as an error.
+            bool failed;
+        private:
+            rpc_operation operation;
+    };
+#endif //_simpleomero_rpc_stats_included_
+}